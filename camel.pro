@@ -11,6 +11,9 @@ LIBS         = -lc++ -lX11 -lpam
 QMAKE_CXX    = clang++
 QMAKE_CXXFLAGS = -std=c++11 -stdlib=libc++ -Wno-deprecated-register
 
+# debug records are only compiled into debug builds
+CONFIG(release, debug|release): DEFINES += LOGGER_MIN_LEVEL=LOG_INFO
+
 ########################################
 count(prefix, 1) {
     prefix = /$(DESTDIR)/$$prefix
@@ -65,11 +68,18 @@ INSTALLS += theme
 ########################################
 SOURCES += \
     lib/credentials/credentials.cpp \
+    lib/credentials/credentials_cache.cpp \
     lib/logger/logger.cpp           \
     lib/pam/pam.cpp                 \
     lib/process/environ.cpp         \
     lib/process/arguments.cpp       \
     lib/process/process.cpp         \
+    lib/process/reactor.cpp         \
+    lib/storage/atomic_file.cpp     \
+    lib/storage/file.cpp            \
+    lib/storage/mapped_file.cpp     \
+    lib/storage/poller.cpp          \
+    lib/x11/authority.cpp           \
     lib/x11/server.cpp              \
     src/config.cpp                  \
     src/main.cpp                    \
@@ -80,6 +90,7 @@ HEADERS += \
     lib/charpp.hpp                  \
     lib/container.hpp               \
     lib/credentials/credentials.hpp \
+    lib/credentials/credentials_cache.hpp \
     lib/enum.hpp                    \
     lib/errno_error.hpp             \
     lib/logger/logger.hpp           \
@@ -90,7 +101,14 @@ HEADERS += \
     lib/process/environ.hpp         \
     lib/process/filebuf.hpp         \
     lib/process/process.hpp         \
+    lib/process/reactor.hpp         \
+    lib/storage/atomic_file.hpp     \
+    lib/storage/file.hpp            \
+    lib/storage/mapped_file.hpp     \
+    lib/storage/perm.hpp            \
+    lib/storage/poller.hpp          \
     lib/string.hpp                  \
+    lib/x11/authority.hpp           \
     lib/x11/server.hpp              \
     src/config.hpp                  \
     src/manager.hpp                 \
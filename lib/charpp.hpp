@@ -10,8 +10,14 @@
 #define CHARPP_HPP
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace app
@@ -21,14 +27,14 @@ namespace app
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 struct charpp_deleter
 {
-    void operator()(char* args[]) noexcept
-    {
-        if(args)
-        {
-            for(char** ri = args; *ri; ++ri) std::free(*ri);
-            std::free(args);
-        }
-    }
+    charpp_deleter() noexcept = default;
+    explicit charpp_deleter(bool owned) noexcept: _M_owned(owned) { }
+
+    // pointer table and strings are allocated as one block (see charpp_arena)
+    void operator()(char* args[]) noexcept { if(_M_owned) std::free(args); }
+
+private:
+    bool _M_owned = true;
 };
 
 ///
@@ -43,6 +49,102 @@ struct charpp_deleter
 ///
 typedef std::unique_ptr<char*[], charpp_deleter> charpp_ptr;
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief charpp_arena
+///
+/// Builds charpp_ptr in one block of memory: the pointer table is followed
+/// by the strings it points to. The block is either allocated with a single
+/// malloc or provided by the caller (eg, on the stack), in which case
+/// the returned charpp_ptr does not free it.
+///
+/// Number of strings and their total length (without terminating NULs)
+/// have to be known up front.
+///
+class charpp_arena
+{
+public:
+    static constexpr std::size_t space(std::size_t count, std::size_t length) noexcept
+    { return (count + 1) * sizeof(char*) + length + count; }
+
+    charpp_arena(std::size_t count, std::size_t length)
+    {
+        void* block = std::malloc(space(count, length));
+        if(block == nullptr) throw std::bad_alloc();
+
+        init(block, count, length);
+        _M_owned = true;
+    }
+
+    charpp_arena(std::size_t count, std::size_t length, void* buffer, std::size_t size)
+    {
+        if(size < space(count, length)) throw std::length_error("charpp_arena: buffer is too small");
+        if(reinterpret_cast<std::uintptr_t>(buffer) % alignof(char*)) throw std::invalid_argument("charpp_arena: misaligned buffer");
+
+        init(buffer, count, length);
+    }
+
+    charpp_arena(const charpp_arena&) = delete;
+    ~charpp_arena() { if(_M_owned) std::free(_M_table); }
+
+    charpp_arena& operator=(const charpp_arena&) = delete;
+
+    ////////////////////
+    void insert(const std::string& x) { insert(x.data(), x.size(), nullptr, 0); }
+
+    // inserts name=value
+    void insert(const std::string& name, const std::string& value)
+    { insert(name.data(), name.size(), value.data(), value.size()); }
+
+    charpp_ptr release() noexcept
+    {
+        *_M_next = nullptr;
+
+        charpp_ptr x(_M_table, charpp_deleter(_M_owned));
+        _M_table = nullptr;
+        _M_owned = false;
+        return x;
+    }
+
+private:
+    char** _M_table = nullptr;
+    char** _M_next = nullptr;
+    char** _M_last = nullptr;
+
+    char* _M_data = nullptr;
+    char* _M_end = nullptr;
+
+    bool _M_owned = false;
+
+    void init(void* block, std::size_t count, std::size_t length) noexcept
+    {
+        _M_next = _M_table = static_cast<char**>(block);
+        _M_last = _M_table + count;
+
+        _M_data = reinterpret_cast<char*>(_M_last + 1);
+        _M_end = _M_data + length + count;
+    }
+
+    void insert(const char* x, std::size_t n, const char* y, std::size_t m)
+    {
+        std::size_t size = y ? n + 1 + m + 1 : n + 1;
+        if(_M_next == _M_last || size > std::size_t(_M_end - _M_data)) throw std::length_error("charpp_arena: out of space");
+
+        *_M_next++ = _M_data;
+
+        std::memcpy(_M_data, x, n);
+        _M_data += n;
+
+        if(y)
+        {
+            *_M_data++ = '=';
+            std::memcpy(_M_data, y, m);
+            _M_data += m;
+        }
+        *_M_data++ = '\0';
+    }
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
@@ -7,6 +7,7 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "credentials.hpp"
+#include "credentials_cache.hpp"
 #include "errno_error.hpp"
 
 #include <grp.h>
@@ -131,12 +132,12 @@ app::gid saved_gid() noexcept
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-std::string username() { return get_pwd(uid())->pw_name; }
-std::string fullname() { return get_pwd(uid())->pw_gecos; }
-std::string password() { return get_pwd(uid())->pw_passwd; }
+std::string username() { return credentials_cache::instance().get(uid()).username(); }
+std::string fullname() { return credentials_cache::instance().get(uid()).fullname(); }
+std::string password() { return credentials_cache::instance().get(uid()).password(); }
 
-std::string home()     { return get_pwd(uid())->pw_dir; }
-std::string shell()    { return get_shell(get_pwd(uid())); }
+std::string home()     { return credentials_cache::instance().get(uid()).home(); }
+std::string shell()    { return credentials_cache::instance().get(uid()).shell(); }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 app::groups groups()
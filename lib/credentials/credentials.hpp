@@ -52,7 +52,7 @@ public:
     const std::string& password() const noexcept { return _M_password; }
 
     app::uid uid() const noexcept { return _M_uid; }
-    app::uid gid() const noexcept { return _M_uid; }
+    app::gid gid() const noexcept { return _M_gid; }
 
     const std::string& home() const noexcept { return _M_home; }
     const std::string& shell() const noexcept { return _M_shell; }
@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "credentials_cache.hpp"
+
+#include <algorithm>
+
+#include <sys/stat.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace app
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool update(const char* path, timespec& mtime, ino_t& ino)
+{
+    struct stat info;
+    if(::stat(path, &info)) info = { };
+
+    bool changed = info.st_mtim.tv_sec != mtime.tv_sec
+                || info.st_mtim.tv_nsec != mtime.tv_nsec
+                || info.st_ino != ino;
+
+    mtime = info.st_mtim;
+    ino = info.st_ino;
+    return changed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void credentials_cache::check()
+{
+    // both have to be updated
+    bool passwd = update("/etc/passwd", _M_passwd.mtime, _M_passwd.ino);
+    bool group = update("/etc/group", _M_group.mtime, _M_group.ino);
+
+    if(passwd || group) _M_entries.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename Pred, typename Key>
+app::credentials credentials_cache::_M_get(Pred pred, const Key& key)
+{
+    std::lock_guard<std::mutex> lock(_M_mutex);
+    check();
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    _M_entries.erase(std::remove_if(_M_entries.begin(), _M_entries.end(), [&](const entry& e){ return e.until <= now; }),
+        _M_entries.end());
+
+    auto ri = std::find_if(_M_entries.begin(), _M_entries.end(), [&](const entry& e){ return pred(e.credentials); });
+    if(ri != _M_entries.end()) return ri->credentials;
+
+    app::credentials x(key);
+    _M_entries.push_back(entry { x, now + _M_ttl });
+    return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+app::credentials credentials_cache::get(const std::string& name)
+{
+    return _M_get([&](const app::credentials& x){ return x.username() == name; }, name);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+app::credentials credentials_cache::get(app::uid uid)
+{
+    return _M_get([&](const app::credentials& x){ return x.uid() == uid; }, uid);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void credentials_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(_M_mutex);
+    _M_entries.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+credentials_cache& credentials_cache::instance()
+{
+    static credentials_cache x;
+    return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
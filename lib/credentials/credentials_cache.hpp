@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef CREDENTIALS_CACHE_HPP
+#define CREDENTIALS_CACHE_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "credentials.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace app
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief credentials_cache
+///
+/// Caches user credentials, so that repeated lookups don't go through
+/// NSS (which for sssd or LDAP means a network round trip) every time.
+///
+/// Entries expire after ttl. All of them are dropped, when modification
+/// time of /etc/passwd or /etc/group changes. Failed lookups are not
+/// cached.
+///
+class credentials_cache
+{
+public:
+    explicit credentials_cache(std::chrono::seconds ttl = std::chrono::seconds(60)): _M_ttl(ttl) { }
+    credentials_cache(const credentials_cache&) = delete;
+    credentials_cache& operator=(const credentials_cache&) = delete;
+
+    app::credentials get(const std::string& name);
+    app::credentials get(app::uid);
+
+    void clear();
+
+    // process-wide cache
+    static credentials_cache& instance();
+
+private:
+    struct entry
+    {
+        app::credentials credentials;
+        std::chrono::steady_clock::time_point until;
+    };
+
+    struct stamp
+    {
+        timespec mtime;
+        ino_t ino;
+    };
+
+    std::mutex _M_mutex;
+    std::vector<entry> _M_entries;
+    std::chrono::seconds _M_ttl;
+
+    stamp _M_passwd = { }, _M_group = { };
+
+    void check();
+
+    template<typename Pred, typename Key>
+    app::credentials _M_get(Pred, const Key&);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // CREDENTIALS_CACHE_HPP
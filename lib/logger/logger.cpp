@@ -8,6 +8,26 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "logger.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno> // program_invocation_short_name
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace app
 {
@@ -16,23 +36,706 @@ namespace app
 namespace log
 {
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace internal
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// Bounded MPSC ring (Vyukov). Each slot carries a sequence number: slot
+/// at position pos is free for the producer when seq == pos and holds
+/// a record for the consumer when seq == pos + 1.
+///
+/// Producers are lock-free. There is one consumer at a time: either
+/// the writer thread or flush(), serialized by _M_consumer.
+///
+class ring
+{
+public:
+    ring();
+
+    void push(app::log::level, const log::site&, const char* text, size_t size, const std::string& context, const char* fields, size_t fields_size) noexcept;
+
+    // final flush also emits all pending summaries
+    void flush(bool final = false) noexcept;
+
+    void set_rate_limit(size_t burst, std::chrono::seconds interval) noexcept
+    {
+        _M_burst.store(burst, std::memory_order_relaxed);
+        _M_interval.store(interval.count(), std::memory_order_relaxed);
+    }
+
+    void set_context(const std::string& name, const std::string& value);
+    bool get_context(std::string& context, unsigned& gen);
+
+    bool open_journal(const std::string& path);
+
+    size_t dropped() const noexcept { return _M_dropped.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t capacity = 256; // power of 2
+
+    struct slot
+    {
+        std::atomic<size_t> seq;
+        app::log::level level;
+        uint64_t key; // hash of call site and text
+        size_t size;
+        char text[logger_base::record_size + 1];
+
+        size_t fields_size;
+        char fields[2 * logger_base::field_size];
+    };
+    slot _M_slots[capacity];
+
+    std::atomic<size_t> _M_tail { 0 };
+    size_t _M_head = 0;
+
+    std::atomic<size_t> _M_dropped { 0 };
+    size_t _M_reported = 0;
+
+    std::mutex _M_consumer;
+
+    int _M_wake = -1;
+    std::atomic<bool> _M_waiting { false };
+    std::atomic<bool> _M_running { false };
+    std::atomic<bool> _M_sync { false }; // writer thread could not be started
+
+    // process context, its generation changes on every update
+    std::mutex _M_context_mutex;
+    std::string _M_context;
+    std::atomic<unsigned> _M_context_gen { 1 };
+
+    // journald socket, if open
+    int _M_journal = -1;
+    static constexpr size_t batch_size = 32;
+
+    // rate limits of recent keys, used by the consumer only
+    struct limit
+    {
+        bool used = false;
+        uint64_t key;
+        std::chrono::steady_clock::time_point start;
+        size_t count, suppressed;
+
+        // last suppressed record
+        app::log::level level;
+        size_t size;
+        char text[logger_base::record_size + 1];
+
+        size_t fields_size;
+        char fields[2 * logger_base::field_size];
+    };
+    static constexpr size_t limit_size = 64;
+    limit _M_limits[limit_size];
+
+    // summaries and other records made by the consumer itself
+    slot _M_notes[batch_size];
+    size_t _M_noted = 0; // notes used by the current batch
+
+    std::atomic<size_t> _M_burst { 10 };
+    std::atomic<long long> _M_interval { 10 }; // seconds
+
+    void reset() noexcept;
+    bool empty() const noexcept;
+
+    void start() noexcept;
+    void run() noexcept;
+
+    // must be called with _M_consumer locked
+    void drain() noexcept;
+    size_t send(slot* batch[], size_t count) noexcept;
+
+    // none of these allocate, as they run in the writer thread
+    void write(slot* batch[], size_t count) noexcept;
+
+    void allow(slot&, std::chrono::steady_clock::time_point now, slot* batch[], size_t& size) noexcept;
+    void expire(std::chrono::steady_clock::time_point now, bool all) noexcept;
+    bool summarize(limit&, slot&) noexcept;
+};
+
+// never destroyed, so that the writer thread
+// can safely outlive static destructors
+ring& instance();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ring::ring()
+{
+    reset();
+    _M_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // forked child does not inherit the writer thread; records in flight
+    // belong to the parent, which is going to write them
+    pthread_atfork(
+        [](){ instance()._M_consumer.lock(); },
+        [](){ instance()._M_consumer.unlock(); },
+        []()
+        {
+            ring& x = instance();
+            x.reset();
+
+            // don't share wake-ups with the parent
+            if(x._M_wake != -1) ::close(x._M_wake);
+            x._M_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+            x._M_waiting = false;
+            x._M_running = false;
+            x._M_sync = false;
+            x._M_consumer.unlock();
+        }
+    );
+
+    // write whatever is left on exit
+    std::atexit([](){ instance().flush(true); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::reset() noexcept
+{
+    for(size_t ri = 0; ri < capacity; ++ri) _M_slots[ri].seq.store(ri, std::memory_order_relaxed);
+
+    _M_tail.store(0, std::memory_order_relaxed);
+    _M_head = 0;
+
+    _M_dropped.store(0, std::memory_order_relaxed);
+    _M_reported = 0;
+
+    for(limit& x : _M_limits) x.used = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ring::empty() const noexcept
+{
+    return _M_slots[_M_head % capacity].seq.load(std::memory_order_acquire) != _M_head + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static uint64_t hash(const char* s, size_t n, uint64_t x = 14695981039346656037ULL)
+{
+    for(; n; --n, ++s) x = (x ^ static_cast<unsigned char>(*s)) * 1099511628211ULL;
+    return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::push(app::log::level level, const log::site& where, const char* text, size_t size, const std::string& context, const char* fields, size_t fields_size) noexcept
+{
+    size_t pos = _M_tail.load(std::memory_order_relaxed);
+    slot* x;
+    while(true)
+    {
+        x = &_M_slots[pos % capacity];
+        ptrdiff_t diff = static_cast<ptrdiff_t>(x->seq.load(std::memory_order_acquire) - pos);
+
+        if(diff == 0)
+        {
+            if(_M_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if(diff < 0)
+        {
+            _M_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else pos = _M_tail.load(std::memory_order_relaxed);
+    }
+
+    x->level = level;
+    // same text from different call sites (or different texts, eg e.what(),
+    // from the same one) is limited and summarized separately
+    x->key = where.file ? hash(text, size, hash(reinterpret_cast<const char*>(&where.line), sizeof(where.line), hash(where.file, std::strlen(where.file))))
+                        : hash(text, size);
+    x->size = size;
+    std::memcpy(x->text, text, size);
+    x->text[size] = '\0';
+
+    std::memcpy(x->fields, context.data(), context.size());
+    std::memcpy(x->fields + context.size(), fields, fields_size);
+    x->fields_size = context.size() + fields_size;
+    x->seq.store(pos + 1, std::memory_order_release);
+
+    if(!_M_running) start();
+    if(_M_sync)
+    {
+        flush();
+        return;
+    }
+
+    // pairs with the fence in run()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_M_waiting.exchange(false)) eventfd_write(_M_wake, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::drain() noexcept
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    while(!empty())
+    {
+        size_t count = 1;
+        while(count < batch_size && _M_slots[(_M_head + count) % capacity].seq.load(std::memory_order_acquire) == _M_head + count + 1) ++count;
+
+        // each record may be preceded by a summary
+        slot* batch[2 * batch_size];
+        size_t size = 0;
+        _M_noted = 0;
+        for(size_t ri = 0; ri < count; ++ri) allow(_M_slots[(_M_head + ri) % capacity], now, batch, size);
+
+        write(batch, size);
+
+        for(size_t ri = 0; ri < count; ++ri, ++_M_head)
+            _M_slots[_M_head % capacity].seq.store(_M_head + capacity, std::memory_order_release);
+    }
+    expire(now, false);
+
+    size_t dropped = _M_dropped.load(std::memory_order_relaxed);
+    if(dropped != _M_reported)
+    {
+        slot& x = _M_notes[0];
+        x.level = warning;
+        x.size = std::min<size_t>(snprintf(x.text, sizeof(x.text), "Dropped %zu log messages", dropped - _M_reported), sizeof(x.text) - 1);
+        x.fields_size = 0;
+
+        slot* batch[] = { &x };
+        write(batch, 1);
+
+        _M_reported = dropped;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::write(slot* batch[], size_t count) noexcept
+{
+    // whatever could not be sent goes to syslog
+    size_t sent = _M_journal != -1 ? send(batch, count) : 0;
+    for(size_t ri = sent; ri < count; ++ri) syslog(batch[ri]->level, "%s", batch[ri]->text);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// Sends records in the batch to the journal, one datagram each:
+///
+///     PRIORITY=<level>
+///     SYSLOG_IDENTIFIER=<program name>
+///     MESSAGE=<text>
+///     <fields>
+///
+/// Returns the number of records sent.
+///
+size_t ring::send(slot* batch[], size_t count) noexcept
+{
+    // not destroyed on exit, the final flush still needs it
+    static char ident[96];
+    static const size_t ident_size = std::min<size_t>(snprintf(ident, sizeof(ident), "SYSLOG_IDENTIFIER=%.64s\n", program_invocation_short_name), sizeof(ident) - 1);
+    static const char message[] = "MESSAGE=";
+
+    char priority[batch_size][16];
+    iovec iov[batch_size][6];
+    mmsghdr msgs[batch_size];
+
+    for(size_t ri = 0; ri < count; ++ri)
+    {
+        slot& x = *batch[ri];
+        int n = snprintf(priority[ri], sizeof(priority[ri]), "PRIORITY=%d\n", static_cast<int>(x.level));
+
+        iov[ri][0] = iovec { priority[ri], static_cast<size_t>(n) };
+        iov[ri][1] = iovec { ident, ident_size };
+        iov[ri][2] = iovec { const_cast<char*>(message), sizeof(message) - 1 };
+        iov[ri][3] = iovec { x.text, x.size };
+        iov[ri][4] = iovec { const_cast<char*>(&_n), 1 };
+        iov[ri][5] = iovec { x.fields, x.fields_size };
+
+        std::memset(&msgs[ri], 0, sizeof(msgs[ri]));
+        msgs[ri].msg_hdr.msg_iov = iov[ri];
+        msgs[ri].msg_hdr.msg_iovlen = 6;
+    }
+
+    // never block for long, if journald is stuck
+    size_t sent = 0;
+    bool waited = false;
+    while(sent < count)
+    {
+        int n = sendmmsg(_M_journal, msgs + sent, count - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n == -1)
+        {
+            if(std::errc(errno) == std::errc::interrupted) continue;
+            if(std::errc(errno) == std::errc::resource_unavailable_try_again && !waited)
+            {
+                pollfd fd = { _M_journal, POLLOUT, 0 };
+                poll(&fd, 1, 100);
+
+                waited = true;
+                continue;
+            }
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// field values can't contain new lines in the simple journal format
+static void append_field(std::string& x, const std::string& name, const std::string& value)
+{
+    x += name;
+    x += '=';
+    for(char c : value) x += c == _n ? ' ' : c;
+    x += _n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::set_context(const std::string& name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(_M_context_mutex);
+
+    // remove old value
+    std::string prefix = name + '=';
+    for(size_t pos = 0; pos < _M_context.size();)
+    {
+        size_t end = _M_context.find(_n, pos) + 1;
+        if(_M_context.compare(pos, prefix.size(), prefix) == 0)
+        {
+            _M_context.erase(pos, end - pos);
+            break;
+        }
+        pos = end;
+    }
+
+    if(value.size())
+    {
+        std::string context = _M_context;
+        append_field(context, name, value);
+
+        if(context.size() > logger_base::field_size) throw std::length_error("Log context too long");
+        _M_context.swap(context);
+    }
+
+    _M_context_gen.fetch_add(1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ring::get_context(std::string& context, unsigned& gen)
+{
+    if(gen == _M_context_gen.load(std::memory_order_acquire)) return false;
+
+    std::lock_guard<std::mutex> lock(_M_context_mutex);
+    context = _M_context;
+    gen = _M_context_gen.load(std::memory_order_relaxed);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool ring::open_journal(const std::string& path)
+{
+    sockaddr_un addr;
+    if(path.size() >= sizeof(addr.sun_path)) return false;
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd == -1) return false;
+
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_M_consumer);
+    if(_M_journal != -1) ::close(_M_journal);
+    _M_journal = fd;
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// Appends the record to the batch, unless it is over its rate limit.
+/// If this starts a new window for its key (or evicts another key),
+/// the summary of the previous one is appended first, so that records
+/// are written in order.
+///
+void ring::allow(slot& x, std::chrono::steady_clock::time_point now, slot* batch[], size_t& size) noexcept
+{
+    size_t burst = _M_burst.load(std::memory_order_relaxed);
+    if(burst == 0 || x.level <= critical)
+    {
+        batch[size++] = &x;
+        return;
+    }
+
+    std::chrono::seconds interval(_M_interval.load(std::memory_order_relaxed));
+
+    limit* e = nullptr;
+    for(limit& l : _M_limits)
+        if(l.used && l.key == x.key)
+        {
+            e = &l;
+            break;
+        }
+
+    if(e && now - e->start >= interval)
+    {
+        // there is one summary per record at most,
+        // so the notes can't run out within a batch
+        if(summarize(*e, _M_notes[_M_noted])) batch[size++] = &_M_notes[_M_noted++];
+        e->used = false;
+    }
+
+    if(!e || !e->used)
+    {
+        if(!e)
+        {
+            // take a free entry or evict the oldest one
+            e = &_M_limits[0];
+            for(limit& l : _M_limits)
+            {
+                if(!l.used)
+                {
+                    e = &l;
+                    break;
+                }
+                if(l.start < e->start) e = &l;
+            }
+
+            if(e->used && summarize(*e, _M_notes[_M_noted])) batch[size++] = &_M_notes[_M_noted++];
+        }
+
+        e->used = true;
+        e->key = x.key;
+        e->start = now;
+        e->count = e->suppressed = 0;
+    }
+
+    if(++e->count <= burst)
+    {
+        batch[size++] = &x;
+        return;
+    }
+
+    ++e->suppressed;
+    e->level = x.level;
+
+    e->size = x.size;
+    std::memcpy(e->text, x.text, x.size);
+
+    e->fields_size = x.fields_size;
+    std::memcpy(e->fields, x.fields, x.fields_size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::expire(std::chrono::steady_clock::time_point now, bool all) noexcept
+{
+    std::chrono::seconds interval(_M_interval.load(std::memory_order_relaxed));
+
+    slot* batch[batch_size];
+    size_t size = 0;
+    for(limit& l : _M_limits)
+        if(l.used && (all || now - l.start >= interval))
+        {
+            if(summarize(l, _M_notes[size])) batch[size] = &_M_notes[size], ++size;
+            l.used = false;
+
+            if(size == batch_size)
+            {
+                write(batch, size);
+                size = 0;
+            }
+        }
+
+    write(batch, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// makes "<text> (repeated N times)" record with the fields
+// of the last suppressed one; returns false, if there was none
+bool ring::summarize(limit& x, slot& note) noexcept
+{
+    if(x.suppressed == 0) return false;
+
+    char suffix[48];
+    size_t n = std::min<size_t>(snprintf(suffix, sizeof(suffix), " (repeated %zu times)", x.suppressed), sizeof(suffix) - 1);
+    size_t size = std::min(x.size, logger_base::record_size - n);
+
+    note.level = x.level;
+
+    std::memcpy(note.text, x.text, size);
+    std::memcpy(note.text + size, suffix, n);
+    note.size = size + n;
+    note.text[note.size] = '\0';
+
+    note.fields_size = x.fields_size;
+    std::memcpy(note.fields, x.fields, x.fields_size);
+
+    x.suppressed = 0;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::flush(bool final) noexcept
+{
+    std::lock_guard<std::mutex> lock(_M_consumer);
+    drain();
+
+    if(final) expire(std::chrono::steady_clock::time_point(), true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::start() noexcept
+{
+    if(_M_running.exchange(true)) return;
+
+    // writer thread never handles signals
+    sigset_t set, prev;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &prev);
+
+    try
+    {
+        if(_M_wake == -1) throw std::runtime_error("No eventfd");
+        std::thread(&ring::run, this).detach();
+    }
+    catch(...)
+    {
+        // write records in the calling thread instead
+        _M_sync = true;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &prev, nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ring::run() noexcept
+{
+    while(true)
+    {
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(_M_consumer);
+            drain();
+
+            _M_waiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            idle = empty();
+        }
+
+        // the time out is only a safety net
+        if(idle)
+        {
+            pollfd fd = { _M_wake, POLLIN, 0 };
+            if(poll(&fd, 1, 1000) > 0)
+            {
+                eventfd_t value;
+                eventfd_read(_M_wake, &value);
+            }
+        }
+        _M_waiting = false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::atomic<int> threshold { LOGGER_MIN_LEVEL };
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ring& instance()
+{
+    static ring* x = new ring;
+    return *x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void logger_base::putchar(char c) noexcept
 {
     if(c == _n)
+        commit();
+    else if(size < record_size)
+        buffer[size++] = c;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void logger_base::put(const char* s, size_t n) noexcept
+{
+    while(n)
     {
-        syslog(level, "%s", buffer.data());
+        const char* e = static_cast<const char*>(std::memchr(s, _n, n));
+        size_t count = e ? e - s : n;
+
+        size_t room = std::min(count, record_size - size);
+        std::memcpy(buffer + size, s, room);
+        size += room;
+
+        if(!e) break;
+
+        commit();
+        s = e + 1;
+        n -= count + 1;
+    }
+}
 
-        buffer.clear();
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void logger_base::add_field(const std::string& name, const std::string& value) noexcept
+{
+    // name, '=', value and '\n'
+    size_t n = name.size() + value.size() + 2;
+    if(fields_size + n > field_size) return;
+
+    char* p = fields + fields_size;
+    p = std::copy(name.begin(), name.end(), p);
+    *p++ = '=';
+    p = std::replace_copy(value.begin(), value.end(), p, _n, ' ');
+    *p++ = _n;
+
+    fields_size += n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void logger_base::commit() noexcept
+{
+    if(!enabled(level))
+    {
+        size = fields_size = 0;
         level = default_level;
+        where = log::site { nullptr, 0 };
+        return;
     }
-    else buffer += c;
+
+    internal::ring& ring = internal::instance();
+
+    try { ring.get_context(context, context_gen); } catch(...) { }
+    ring.push(level, where, buffer, size, context, fields, fields_size);
+
+    size = fields_size = 0;
+    level = default_level;
+    where = log::site { nullptr, 0 };
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 logger_base::~logger_base()
 {
-    if(buffer.size()) putchar(_n);
+    if(size) commit();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t dropped() noexcept { return internal::instance().dropped(); }
+
+void flush() noexcept { internal::instance().flush(); }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void set_context(const std::string& name, const std::string& value)
+{
+    internal::instance().set_context(name, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool open_journal(const std::string& path) { return internal::instance().open_journal(path); }
+
+void set_rate_limit(size_t burst, std::chrono::seconds interval) noexcept
+{
+    internal::instance().set_rate_limit(burst, interval);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -10,6 +10,9 @@
 #define LOGGER_HPP
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <ostream>
 #include <streambuf>
 #include <string>
@@ -18,6 +21,26 @@
 
 constexpr char _n = '\n';
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// records below this level are compiled out, when logged with LOGGER()
+#ifndef LOGGER_MIN_LEVEL
+#  define LOGGER_MIN_LEVEL LOG_DEBUG
+#endif
+
+///
+/// \brief LOGGER
+///
+/// Logs a record, if its level is enabled, eg:
+///
+///     LOGGER(log::debug) << "Expensive " << dump() << std::endl;
+///
+/// Nothing after LOGGER() is evaluated, when the level is disabled.
+///
+/// The call site is recorded and, along with the text, used to rate limit
+/// the record (see set_rate_limit()).
+///
+#define LOGGER(level) if(!app::log::enabled(level)) ; else app::logger << app::log::site { __FILE__, __LINE__ } << (level)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace app
 {
@@ -40,21 +63,124 @@ enum level
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+// call site of the record
+struct site
+{
+    const char* file;
+    int line;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief logger_base
+///
+/// Collects a record in a per-thread buffer and, once it is complete,
+/// pushes it into a lock-free bounded ring. The ring is drained by
+/// a background writer thread, so logging never blocks on syslog.
+///
+/// Records longer than record_size are truncated. If the ring is full,
+/// the record is dropped and counted (see dropped()).
+///
+/// Each record carries structured fields: those of the process context
+/// (see set_context()) and those streamed in with log::field. Fields are
+/// only used by the journal sink (see open_journal()).
+///
 class logger_base
 {
+public:
+    static constexpr size_t record_size = 1000;
+    static constexpr size_t field_size = 256;
+
 protected:
     void putchar(char c) noexcept;
+    void put(const char* s, size_t n) noexcept;
     void set_level(app::log::level x) noexcept { level = x; }
+    void set_site(const log::site& x) noexcept { where = x; }
+    void add_field(const std::string& name, const std::string& value) noexcept;
 
     ~logger_base();
 
 private:
     static constexpr app::log::level default_level = info;
     app::log::level level = default_level;
+    log::site where { nullptr, 0 };
+
+    char buffer[record_size];
+    size_t size = 0;
 
-    std::string buffer;
+    // NAME=value lines
+    char fields[field_size];
+    size_t fields_size = 0;
+
+    // copy of the process context
+    std::string context;
+    unsigned context_gen = 0;
+
+    void commit() noexcept;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief field
+///
+/// Structured field of the record, eg:
+///
+///     logger << log::field("STAGE", "login") << "User logged in" << std::endl;
+///
+/// Names should consist of upper case letters, digits and underscores.
+///
+struct field
+{
+    field(std::string name, std::string value): name(std::move(name)), value(std::move(value)) { }
+    field(std::string name, long long value): name(std::move(name)), value(std::to_string(value)) { }
+
+    std::string name;
+    std::string value;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// add field to all following records of the process, empty value removes it
+void set_context(const std::string& name, const std::string& value);
+
+///
+/// \brief open_journal
+///
+/// Switches from syslog to the journald native protocol, which keeps
+/// structured fields. Records are sent in batches with sendmmsg. Returns
+/// false (and keeps using syslog) if the socket could not be opened.
+///
+bool open_journal(const std::string& path = "/run/systemd/journal/socket");
+
+///
+/// \brief set_rate_limit
+///
+/// Allows up to burst records per interval with the same text from each
+/// call site (records logged without LOGGER() are keyed on the text only),
+/// so that unrelated errors from one site don't share a limit. Further
+/// records are suppressed and, once the interval is over, summarized with
+/// the text followed by "(repeated N times)". Records at critical or more
+/// severe level are never suppressed. Zero burst disables rate limiting.
+///
+/// Default is 10 records per 10 seconds.
+///
+void set_rate_limit(size_t burst, std::chrono::seconds interval) noexcept;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace internal { extern std::atomic<int> threshold; }
+
+// records above the threshold (less severe) are discarded
+inline app::log::level threshold() noexcept { return static_cast<app::log::level>(internal::threshold.load(std::memory_order_relaxed)); }
+inline void set_threshold(app::log::level x) noexcept { internal::threshold.store(x, std::memory_order_relaxed); }
+
+inline bool enabled(app::log::level x) noexcept { return x <= LOGGER_MIN_LEVEL && x <= threshold(); }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// number of records dropped so far, because the ring was full
+size_t dropped() noexcept;
+
+// waits until all pushed records have been written
+void flush() noexcept;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template< typename CharT, typename Traits = std::char_traits<CharT> >
 class logger_streambuf: public std::basic_streambuf<CharT, Traits>, public logger_base
@@ -75,6 +201,12 @@ protected:
         return c;
     }
 
+    std::streamsize xsputn(const char_type* s, std::streamsize n) override
+    {
+        put(s, n);
+        return n;
+    }
+
     template<typename, typename> friend class logger_stream;
 };
 
@@ -91,6 +223,18 @@ public:
         return (*this);
     }
 
+    logger_stream& operator<<(const log::site& x) noexcept
+    {
+        buffer.set_site(x);
+        return (*this);
+    }
+
+    logger_stream& operator<<(const log::field& x) noexcept
+    {
+        buffer.add_field(x.name, x.value);
+        return (*this);
+    }
+
 protected:
     logger_streambuf<CharT, Traits> buffer;
 };
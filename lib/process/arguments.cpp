@@ -16,31 +16,107 @@ namespace app
 {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-charpp_ptr arguments::to_charpp() const
+arguments arguments::split(const std::string& command)
 {
-    char** rp = static_cast<char**>(calloc(size() + 1, sizeof(char*)));
-    if(rp == nullptr) throw std::bad_alloc();
+    arguments args;
+
+    std::string arg;
+    bool found = false; // "" is an empty argument
+    char quote = 0;
+
+    for(auto ri = command.begin(); ri != command.end(); ++ri)
+    {
+        if(quote == '\'')
+        {
+            if(*ri == '\'')
+                quote = 0;
+            else arg += *ri;
+        }
+        else if(*ri == '\\')
+        {
+            if(++ri == command.end()) throw std::invalid_argument("Trailing backslash in " + command);
 
-    charpp_ptr x(rp);
-    for(auto ri = cbegin(); ri != cend(); ++ri, ++rp) *rp = strdup(ri->data());
+            // inside double quotes backslash only escapes special characters
+            if(quote == '"' && !std::strchr("\"\\$`", *ri)) arg += '\\';
+            arg += *ri;
+            found = true;
+        }
+        else if(quote == '"')
+        {
+            if(*ri == '"')
+                quote = 0;
+            else arg += *ri;
+        }
+        else if(*ri == '\'' || *ri == '"')
+        {
+            quote = *ri;
+            found = true;
+        }
+        else if(*ri == ' ' || *ri == '\t' || *ri == '\n')
+        {
+            if(found)
+            {
+                args.insert(std::move(arg));
+                arg.clear();
+                found = false;
+            }
+        }
+        else
+        {
+            arg += *ri;
+            found = true;
+        }
+    }
+
+    if(quote) throw std::invalid_argument("Unterminated quote in " + command);
+    if(found) args.insert(std::move(arg));
+
+    return args;
+}
 
-    *rp = nullptr;
-    return x;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static std::size_t length(const arguments& args) noexcept
+{
+    std::size_t n = 0;
+    for(const std::string& x : args) n += x.size();
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+charpp_ptr arguments::to_charpp() const
+{
+    charpp_arena arena(size(), length(*this));
+    for(const std::string& x : *this) arena.insert(x);
+
+    return arena.release();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 charpp_ptr arguments::to_charpp(const std::string& prepend) const
 {
-    char** rp = static_cast<char**>(calloc(size() + 2, sizeof(char*)));
-    if(rp == nullptr) throw std::bad_alloc();
+    charpp_arena arena(size() + 1, prepend.size() + length(*this));
+
+    arena.insert(prepend);
+    for(const std::string& x : *this) arena.insert(x);
 
-    charpp_ptr x(rp);
-    *rp++ = strdup(prepend.data());
+    return arena.release();
+}
 
-    for(auto ri = cbegin(); ri != cend(); ++ri, ++rp) *rp = strdup(ri->data());
+///////////////////////////////////////////////////////////////////////////////////////////////////
+charpp_ptr arguments::to_charpp(const std::string& prepend, void* buffer, std::size_t size) const
+{
+    charpp_arena arena(this->size() + 1, prepend.size() + length(*this), buffer, size);
 
-    *rp = nullptr;
-    return x;
+    arena.insert(prepend);
+    for(const std::string& x : *this) arena.insert(x);
+
+    return arena.release();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t arguments::charpp_size(const std::string& prepend) const noexcept
+{
+    return charpp_arena::space(size() + 1, prepend.size() + length(*this));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,6 +13,7 @@
 #include "charpp.hpp"
 #include "container.hpp"
 
+#include <cstddef>
 #include <initializer_list>
 #include <string>
 #include <vector>
@@ -38,9 +39,24 @@ public:
     using container::insert;
     using container::erase;
 
+    ///
+    /// \brief split
+    ///
+    /// Splits command line into arguments the way shell would, but without
+    /// expansions: arguments are separated by blanks, can be quoted with
+    /// single or double quotes, and backslash escapes the next character
+    /// (except inside single quotes).
+    ///
+    static arguments split(const std::string& command);
+
     ////////////////////
     charpp_ptr to_charpp() const;
     charpp_ptr to_charpp(const std::string& prepend) const;
+
+    // build charpp_ptr in the caller-provided buffer, which has
+    // to be at least charpp_size() bytes and aligned for char*
+    charpp_ptr to_charpp(const std::string& prepend, void* buffer, std::size_t size) const;
+    std::size_t charpp_size(const std::string& prepend) const noexcept;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -10,24 +10,48 @@
 #include "errno_error.hpp"
 #include "string.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace app
 {
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// total length of name=value strings
+static std::size_t length(const environ& e) noexcept
+{
+    std::size_t n = 0;
+    for(const auto& x : e) n += x.first.size() + 1 + x.second.size();
+    return n;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 charpp_ptr environ::to_charpp() const
 {
-    char** rp = static_cast<char**>(calloc(size() + 1, sizeof(char*)));
-    if(rp == nullptr) throw std::bad_alloc();
+    charpp_arena arena(size(), length(*this));
+    for(const auto& x : *this) arena.insert(x.first, x.second);
 
-    charpp_ptr x(rp);
-    for(auto ri = cbegin(); ri != cend(); ++ri, ++rp) *rp = strdup((ri->first + "=" + ri->second).data());
+    return arena.release();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+charpp_ptr environ::to_charpp(void* buffer, std::size_t size) const
+{
+    charpp_arena arena(this->size(), length(*this), buffer, size);
+    for(const auto& x : *this) arena.insert(x.first, x.second);
+
+    return arena.release();
+}
 
-    *rp = nullptr;
-    return x;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t environ::charpp_size() const noexcept
+{
+    return charpp_arena::space(size(), length(*this));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -36,23 +60,149 @@ environ environ::from_charpp(char* args[], bool free)
     environ e;
     if(args)
     {
-        for(char** ri = args; *ri; ++ri)
+        char** ri = args;
+        while(*ri) ++ri;
+        e.reserve(ri - args);
+
+        for(ri = args; *ri; ++ri)
         {
-            std::string x = *ri;
-            auto pos = x.find_first_of('=');
+            const char* pos = std::strchr(*ri, '=');
+            if(pos) e._M_c.emplace_back(std::string(*ri, pos - *ri), std::string(pos + 1));
 
-            if(pos != std::string::npos) e.insert(x.substr(0, pos), x.substr(pos + 1));
             if(free) ::free(*ri);
         }
         if(free) ::free(args);
+
+        // sort once instead of inserting in order,
+        // the first of the duplicates wins (as with insert)
+        std::stable_sort(e._M_c.begin(), e._M_c.end(), [](const pair_type& x, const pair_type& y)
+            { return x.first < y.first; });
+        e._M_c.erase(std::unique(e._M_c.begin(), e._M_c.end(), [](const pair_type& x, const pair_type& y)
+            { return x.first == y.first; }), e._M_c.end());
     }
     return e;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+charpp_ptr environ::compose(std::initializer_list<const environ*> list)
+{
+    // shadowed variables are counted too,
+    // so this is the upper bound
+    std::size_t count = 0, total = 0;
+
+    std::vector<std::pair<const_iterator, const_iterator>> pos;
+    pos.reserve(list.size());
+
+    for(const environ* e : list)
+    {
+        count += e->size();
+        total += length(*e);
+        pos.emplace_back(e->begin(), e->end());
+    }
+
+    charpp_arena arena(count, total);
+    while(true)
+    {
+        // smallest of the names, first one wins
+        const pair_type* x = nullptr;
+        for(const auto& p : pos)
+            if(p.first != p.second && (!x || p.first->first < x->first)) x = &*p.first;
+
+        if(x == nullptr) break;
+        arena.insert(x->first, x->second);
+
+        string_ref name(x->first);
+        for(auto& p : pos)
+            if(p.first != p.second && string_ref(p.first->first) == name) ++p.first;
+    }
+
+    return arena.release();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+environ::iterator environ::lower_bound(string_ref name)
+{
+    return std::lower_bound(_M_c.begin(), _M_c.end(), name, [](const pair_type& x, string_ref name)
+        { return string_ref(x.first) < name; });
+}
+
+environ::const_iterator environ::lower_bound(string_ref name) const
+{
+    return std::lower_bound(_M_c.begin(), _M_c.end(), name, [](const pair_type& x, string_ref name)
+        { return string_ref(x.first) < name; });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+environ::iterator environ::find(string_ref name)
+{
+    iterator ri = lower_bound(name);
+    return ri != end() && string_ref(ri->first) == name ? ri : end();
+}
+
+environ::const_iterator environ::find(string_ref name) const
+{
+    const_iterator ri = lower_bound(name);
+    return ri != end() && string_ref(ri->first) == name ? ri : end();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+environ::value_type& environ::get(string_ref name)
+{
+    iterator ri = find(name);
+    if(ri == end()) throw std::out_of_range("environ::get");
+
+    return ri->second;
+}
+
+const environ::value_type& environ::get(string_ref name) const
+{
+    const_iterator ri = find(name);
+    if(ri == end()) throw std::out_of_range("environ::get");
+
+    return ri->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void environ::erase(string_ref name)
+{
+    iterator ri = find(name);
+    if(ri != end()) _M_c.erase(ri);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace this_environ
 {
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void snapshot::refresh() noexcept
+{
+    // ::environ is read once, as it may be replaced meanwhile
+    char** ri = _M_base = ::environ;
+    if(ri) while(*ri) ++ri;
+
+    _M_size = ri - _M_base;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+string_ref snapshot::get_ref(string_ref name, bool* found) const noexcept
+{
+    for(iterator ri = begin(), end = this->end(); ri != end; ++ri)
+    {
+        if(ri.name_ref() == name)
+        {
+            if(found) *found = true;
+            return ri.value_ref();
+        }
+    }
+
+    if(found) *found = false;
+    return string_ref();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_type size() noexcept { return snapshot().size(); }
+iterator end() noexcept { return snapshot().end(); }
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 value_type get(const name_type& name, bool* found) noexcept
 {
@@ -62,6 +212,12 @@ value_type get(const name_type& name, bool* found) noexcept
     return x ? std::string(x) : std::string();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+string_ref get_ref(string_ref name, bool* found) noexcept
+{
+    return snapshot().get_ref(name, found);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void insert(const name_type& name, const value_type& value, bool over)
 {
@@ -94,6 +250,15 @@ name_type name(char* v, bool* found)
     return n;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+string_ref name_ref(const char* x) noexcept
+{
+    if(x == nullptr) return string_ref();
+
+    const char* pos = std::strchr(x, '=');
+    return pos ? string_ref(x, pos - x) : string_ref(x);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 value_type value(char* x, bool* found)
 {
@@ -107,6 +272,15 @@ value_type value(char* x, bool* found)
     return v;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+string_ref value_ref(const char* x) noexcept
+{
+    if(x == nullptr) return string_ref();
+
+    const char* pos = std::strchr(x, '=');
+    return pos ? string_ref(pos + 1) : string_ref();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
@@ -12,12 +12,14 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "charpp.hpp"
 #include "container.hpp"
+#include "string.hpp"
 
 #include <cstddef>
+#include <initializer_list>
 #include <iterator>
-#include <map>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <unistd.h>
 
@@ -27,11 +29,21 @@ namespace app
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-class environ: public container<std::map<std::string, std::string>>
+///
+/// \brief environ
+///
+/// Environment variables kept in a vector sorted by name: lookups are binary
+/// searches without a temporary std::string for the name (see string_ref),
+/// and whole environment takes only a few allocations (see reserve).
+///
+/// As with std::map, insert does not replace existing variables.
+///
+class environ: public container<std::vector<std::pair<std::string, std::string>>>
 {
 public:
-    typedef typename container_type::key_type name_type;
-    typedef typename container_type::mapped_type value_type;
+    typedef std::string name_type;
+    typedef std::string value_type;
+    typedef typename container_type::value_type pair_type;
 
 public:
     environ() = default;
@@ -41,30 +53,57 @@ public:
     environ& operator=(const environ&) = default;
     environ& operator=(environ&&) = default;
 
+    void reserve(size_type n) { _M_c.reserve(n); }
+
     ////////////////////
-    value_type& get(const name_type& name) { return _M_c.at(name); }
-    const value_type& get(const name_type& name) const { return _M_c.at(name); }
+    value_type& get(string_ref name);
+    const value_type& get(string_ref name) const;
 
     ////////////////////
     template<typename NameType, typename ValueType>
     void insert(NameType&& name, ValueType&& value)
     {
-        insert(std::make_pair(std::forward<NameType>(name), std::forward<ValueType>(value)));
+        iterator ri = lower_bound(name);
+        if(ri == end() || string_ref(ri->first) != name)
+            _M_c.emplace(ri, std::forward<NameType>(name), std::forward<ValueType>(value));
     }
-    using container::insert;
+
+    void insert(const pair_type& x) { insert(x.first, x.second); }
+    void insert(pair_type&& x) { insert(std::move(x.first), std::move(x.second)); }
+    void insert(std::initializer_list<pair_type> x) { for(const pair_type& p : x) insert(p); }
+    void insert(const environ& x) { for(const pair_type& p : x) insert(p); }
 
     using container::erase;
-    void erase(const name_type& name) { _M_c.erase(name); }
+    void erase(string_ref name);
 
     ////////////////////
-    size_type count(const name_type& name) const { return _M_c.count(name); }
+    size_type count(string_ref name) const { return find(name) != end(); }
 
-    iterator find(const name_type& name) { return _M_c.find(name); }
-    const_iterator find(const name_type& name) const { return _M_c.find(name); }
+    iterator find(string_ref name);
+    const_iterator find(string_ref name) const;
 
     ////////////////////
     charpp_ptr to_charpp() const;
+
+    // build charpp_ptr in the caller-provided buffer, which has
+    // to be at least charpp_size() bytes and aligned for char*
+    charpp_ptr to_charpp(void* buffer, std::size_t size) const;
+    std::size_t charpp_size() const noexcept;
+
     static environ from_charpp(char*[], bool free = false);
+
+    ///
+    /// \brief compose
+    ///
+    /// Builds exec-ready charpp_ptr out of several environs in one sorted walk
+    /// over all of them, without any intermediate environ. If a variable is
+    /// present in more than one of them, the first one wins.
+    ///
+    static charpp_ptr compose(std::initializer_list<const environ*>);
+
+private:
+    iterator lower_bound(string_ref name);
+    const_iterator lower_bound(string_ref name) const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +131,10 @@ name_type name(Iterator ri, bool* found = nullptr) { return name(*ri, found); }
 template<typename Iterator>
 value_type value(Iterator ri, bool* found = nullptr) { return value(*ri, found); }
 
+// same as above, but without copying
+string_ref name_ref(const char*) noexcept;
+string_ref value_ref(const char*) noexcept;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class iterator: public std::iterator<std::bidirectional_iterator_tag, char*, ptrdiff_t, char**, char*>
 {
@@ -107,6 +150,9 @@ public:
     this_environ::name_type name(bool* found = nullptr) const { return this_environ::name(*this, found); }
     this_environ::value_type value(bool* found = nullptr) const { return this_environ::value(*this, found); }
 
+    string_ref name_ref() const noexcept { return this_environ::name_ref(operator*()); }
+    string_ref value_ref() const noexcept { return this_environ::value_ref(operator*()); }
+
     iterator& operator++() noexcept { ++_M_p; return (*this); }
     iterator operator++(int) noexcept
     {
@@ -125,24 +171,27 @@ public:
 
     friend bool operator==(const iterator& x, const iterator& y) noexcept { return x._M_p == y._M_p; }
     friend bool operator!=(const iterator& x, const iterator& y) noexcept { return x._M_p != y._M_p; }
-    friend size_type size() noexcept;
-
 private:
     pointer _M_p;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 value_type get(const name_type& name, bool* found = nullptr) noexcept;
+
+///
+/// \brief get_ref
+///
+/// Same as get, but returns reference to the value stored in the environment,
+/// which remains valid until the environment is modified.
+///
+string_ref get_ref(string_ref name, bool* found = nullptr) noexcept;
+
 void insert(const name_type& name, const value_type& value, bool over = true);
 void erase(const std::string& name);
 
 ////////////////////
 inline iterator begin() noexcept { return iterator(::environ); }
-inline iterator end() noexcept
-{
-    iterator ri = begin(); while(*ri) ++ri;
-    return ri;
-}
+iterator end() noexcept;
 
 inline reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
 inline reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
@@ -155,12 +204,46 @@ inline const_reverse_iterator crend() noexcept { return rend(); }
 
 ////////////////////
 inline bool empty() noexcept { return *begin() == nullptr; }
-inline size_type size() noexcept { return end()._M_p - begin()._M_p; }
+
+// walk the environment to the terminating NULL (see snapshot)
+size_type size() noexcept;
 
 size_type count(const name_type& name) noexcept;
 
 inline app::environ environ() { return app::environ::from_charpp(::environ); }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief snapshot
+///
+/// ::environ and its length, captured once. end() and size() are O(1) and
+/// repeated lookups share a single walk. There is no hidden global state:
+/// each caller owns its snapshot, which is valid until the environment is
+/// modified (insert, erase, setenv or putenv), after which it has to be
+/// refreshed.
+///
+class snapshot
+{
+public:
+    snapshot() noexcept { refresh(); }
+
+    // capture ::environ again
+    void refresh() noexcept;
+
+    iterator begin() const noexcept { return iterator(_M_base); }
+    iterator end() const noexcept { return iterator(_M_base + _M_size); }
+
+    bool empty() const noexcept { return _M_size == 0; }
+    size_type size() const noexcept { return _M_size; }
+
+    // see this_environ::get_ref
+    string_ref get_ref(string_ref name, bool* found = nullptr) const noexcept;
+
+private:
+    char** _M_base;
+    size_type _M_size;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
@@ -10,12 +10,23 @@
 #include "errno_error.hpp"
 #include "process.hpp"
 
+#include <algorithm>
+#include <csignal>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -27,16 +38,212 @@ namespace app
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 process::~process()
 {
-    if(running())
+    if(running()) stop(std::chrono::seconds(3));
+    if(_M_fd != -1) close(_M_fd);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void process::open_fd() noexcept
+{
+#if defined(SYS_pidfd_open)
+    // pidfd is always close-on-exec
+    _M_fd = syscall(SYS_pidfd_open, _M_id, 0);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief stopper
+///
+/// Background thread, which reaps processes passed to process::stop
+/// and kills those of them that did not exit in time.
+///
+class stopper
+{
+public:
+    static stopper& instance()
     {
-        terminate();
-        if(!can_join(std::chrono::seconds(3))) kill();
+        // never destroyed, as the thread may outlive static objects
+        static stopper* x = new stopper();
+        return *x;
+    }
+
+    void insert(process&&, std::chrono::steady_clock::time_point until, exit_func);
+    void wait();
+
+private:
+    stopper();
+
+    struct entry
+    {
+        app::process process;
+        std::chrono::steady_clock::time_point until;
+        exit_func func;
+
+        // group leader has exited, but the rest of the group is still running
+        bool tick;
+    };
+
+    std::mutex _M_mutex;
+    std::condition_variable _M_empty;
+
+    // wakes up the thread, when a process is inserted
+    int _M_wake = -1;
+
+    std::vector<entry> _M_entries;
+    bool _M_running = false;
+
+    void run();
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+stopper::stopper()
+{
+    _M_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(_M_wake == -1) throw errno_error();
+
+    // forked child does not inherit the thread,
+    // nor the processes it was waiting on
+    pthread_atfork(
+        [](){ instance()._M_mutex.lock(); },
+        [](){ instance()._M_mutex.unlock(); },
+        []()
+        {
+            stopper& x = instance();
+            for(entry& e : x._M_entries) e.process.detach();
+
+            x._M_entries.clear();
+            x._M_running = false;
+            x._M_mutex.unlock();
+        }
+    );
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void stopper::insert(process&& p, std::chrono::steady_clock::time_point until, exit_func func)
+{
+    std::lock_guard<std::mutex> lock(_M_mutex);
+    _M_entries.push_back(entry { std::move(p), until, std::move(func), false });
+
+    if(!_M_running)
+    {
+        // the thread must never handle signals (eg, SIGUSR1 from the X server
+        // would kill the whole process), so it starts with all of them blocked
+        sigset_t set, prev;
+        sigfillset(&set);
+        pthread_sigmask(SIG_SETMASK, &set, &prev);
+
+        try
+        {
+            std::thread(&stopper::run, this).detach();
+        }
+        catch(...)
+        {
+            pthread_sigmask(SIG_SETMASK, &prev, nullptr);
+            throw;
+        }
+        pthread_sigmask(SIG_SETMASK, &prev, nullptr);
+
+        _M_running = true;
+    }
+
+    if(eventfd_write(_M_wake, 1)) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void stopper::wait()
+{
+    std::unique_lock<std::mutex> lock(_M_mutex);
+    _M_empty.wait(lock, [this](){ return _M_entries.empty(); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void stopper::run()
+{
+    std::vector<pollfd> fds;
+    std::vector<std::size_t> index;
+
+    std::unique_lock<std::mutex> lock(_M_mutex);
+    while(true)
+    {
+        fds.assign(1, pollfd { _M_wake, POLLIN, 0 });
+        index.clear();
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration timeout = std::chrono::steady_clock::duration::max();
+
+        std::vector<entry> done;
+        for(auto ri = _M_entries.begin(); ri != _M_entries.end();)
+        {
+            bool running;
+            try
+            {
+                running = ri->process.running();
+                if(running && now >= ri->until)
+                {
+                    ri->process.kill();
+                    ri->until = std::chrono::steady_clock::time_point::max();
+                }
+            }
+            catch(...)
+            {
+                ri->process.detach();
+                running = false;
+            }
+
+            if(running)
+            {
+                if(ri->until != std::chrono::steady_clock::time_point::max())
+                    timeout = std::min(timeout, ri->until - now);
+
+                if(ri->process.get_fd() == -1 || ri->tick)
+                    timeout = std::min<std::chrono::steady_clock::duration>(timeout, std::chrono::milliseconds(10));
+                else
+                {
+                    fds.push_back(pollfd { ri->process.get_fd(), POLLIN, 0 });
+                    index.push_back(ri - _M_entries.begin());
+                }
+                ++ri;
+            }
+            else
+            {
+                done.push_back(std::move(*ri));
+                ri = _M_entries.erase(ri);
+            }
+        }
+
+        if(done.size())
+        {
+            lock.unlock();
+            for(entry& e : done) if(e.func) e.func(e.process.exit_code());
+            lock.lock();
+
+            if(_M_entries.empty()) _M_empty.notify_all();
+            continue;
+        }
+
+        int ms = -1;
+        if(timeout != std::chrono::steady_clock::duration::max())
+            ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count() + 1;
+
+        lock.unlock();
+
+        if(poll(fds.data(), fds.size(), ms) > 0 && fds[0].revents)
+        {
+            eventfd_t x;
+            eventfd_read(_M_wake, &x);
+        }
+
+        lock.lock();
+
+        // inserted entries are appended, so the indices are still valid
+        for(std::size_t ri = 1; ri < fds.size(); ++ri)
+            if(fds[ri].revents) _M_entries[index[ri - 1]].tick = true;
     }
 }
 
-#if !defined(disable_process_redir)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static inline void discard(int fd) noexcept
+static inline void discard(int& fd) noexcept
 {
     if(fd != -1)
     {
@@ -51,6 +258,8 @@ static inline void discard(int fd[2]) noexcept
     discard(fd[1]);
 }
 
+#if !defined(disable_process_redir)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 static void pipe_if(bool cond, int fd[2])
 {
@@ -131,6 +340,7 @@ void process::_M_process(std::function<int()> func, bool group, app::redir x)
         open_if(x && redir::cerr, cerr, _M_cerr, std::ios_base::in, err_fd, 0);
 #endif
 
+        open_fd();
         if(group)
         {
             if(setpgid(_M_id, _M_id)) throw errno_error();
@@ -151,6 +361,191 @@ void process::_M_process(std::function<int()> func, bool group, app::redir x)
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// Runs in the vforked child, which shares memory with the parent.
+/// Only system calls are allowed here, no allocations or exceptions.
+/// Errors are reported through the close-on-exec status pipe, which
+/// the parent reads after vfork returns.
+///
+static void spawn_child(char* argv[], char* envp[], app::spawn_opt opt, int redir_fd[3], int status)
+{
+    if(opt && spawn_opt::group)
+    {
+        if(setpgid(0, 0)) goto fail;
+    }
+
+    // the parent is suspended until exec, so it can't die before this
+    if(opt && spawn_opt::tied)
+    {
+        if(prctl(PR_SET_PDEATHSIG, SIGTERM)) goto fail;
+    }
+
+    for(int fd = 0; fd < 3; ++fd)
+        if(redir_fd[fd] != -1 && dup2(redir_fd[fd], fd) == -1) goto fail;
+
+    // status pipe is kept open until exec
+#if defined(SYS_close_range)
+    if((status > 3 && syscall(SYS_close_range, 3, status - 1, 0)) || syscall(SYS_close_range, status + 1, ~0U, 0))
+#endif
+    {
+        for(int fd = 0; fd < 3; ++fd) if(redir_fd[fd] > 2 && redir_fd[fd] != status) close(redir_fd[fd]);
+    }
+
+    for(int sig = 1; sig < NSIG; ++sig)
+    {
+        struct sigaction sa;
+        if(sigaction(sig, nullptr, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN)
+        {
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, nullptr);
+        }
+    }
+
+    if(opt && spawn_opt::notify)
+    {
+        struct sigaction sa;
+        sa.sa_handler = SIG_IGN;
+        sa.sa_flags = 0;
+        sigemptyset(&sa.sa_mask);
+        if(sigaction(SIGUSR1, &sa, nullptr)) goto fail;
+    }
+
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK, &set, nullptr);
+    }
+
+    if(envp)
+        execve(argv[0], argv, envp);
+    else execv(argv[0], argv);
+
+fail:
+    int error = errno;
+    while(write(status, &error, sizeof(error)) == -1 && errno == EINTR);
+    _exit(127);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void process::_M_spawn(const std::string& path, const arguments& args, const environ* e, app::spawn_opt opt, app::redir x)
+{
+    // arguments and environment are usually small enough
+    // to be built on the stack without any allocations
+    alignas(char*) char argv_buf[4096], envp_buf[16384];
+
+    charpp_ptr argv = args.charpp_size(path) <= sizeof(argv_buf) ?
+        args.to_charpp(path, argv_buf, sizeof(argv_buf)) : args.to_charpp(path);
+
+    charpp_ptr envp = !e ? nullptr : e->charpp_size() <= sizeof(envp_buf) ?
+        e->to_charpp(envp_buf, sizeof(envp_buf)) : e->to_charpp();
+
+    int redir_fd[3] = { -1, -1, -1 };
+    int status[2] = { -1, -1 };
+#if !defined(disable_process_redir)
+    int out_fd[2] = { -1, -1 }, in_fd[2] = { -1, -1 }, err_fd[2] = { -1, -1 };
+#else
+    (void)x;
+#endif
+
+    try
+    {
+#if !defined(disable_process_redir)
+        pipe_if(x && redir::cout, out_fd);
+        pipe_if(x && redir::cin, in_fd);
+        pipe_if(x && redir::cerr, err_fd);
+
+        redir_fd[STDIN_FILENO] = in_fd[0];
+        redir_fd[STDOUT_FILENO] = out_fd[1];
+        redir_fd[STDERR_FILENO] = err_fd[1];
+#endif
+
+        if(pipe2(status, O_CLOEXEC)) throw errno_error();
+
+        // signal handlers must not run in the child,
+        // while it is sharing memory with the parent
+        sigset_t set, prev;
+        sigfillset(&set);
+        pthread_sigmask(SIG_SETMASK, &set, &prev);
+
+        // failing system calls in the child overwrite errno, which
+        // it shares with the parent; restore it once vfork returns
+        int saved = errno;
+        _M_id = vfork();
+        if(_M_id == 0) spawn_child(argv.get(), envp.get(), opt, redir_fd, status[1]);
+
+        int code = _M_id == -1 ? errno : 0;
+        errno = saved;
+
+        pthread_sigmask(SIG_SETMASK, &prev, nullptr);
+        discard(status[1]);
+
+        if(_M_id == -1) throw errno_error(code, std::generic_category());
+
+        // the child has either called exec, which closed the pipe,
+        // or has written the error and exited
+        int error;
+        ssize_t n;
+        do n = read(status[0], &error, sizeof(error));
+        while(n == -1 && std::errc(errno) == std::errc::interrupted);
+        discard(status[0]);
+
+        if(n == sizeof(error))
+        {
+            waitpid(_M_id, nullptr, 0);
+            throw errno_error(error, std::generic_category());
+        }
+
+#if !defined(disable_process_redir)
+        open_if(x && redir::cout, cout, _M_cout, std::ios_base::in, out_fd, 0);
+        open_if(x && redir::cin, cin, _M_cin, std::ios_base::out, in_fd, 1);
+        open_if(x && redir::cerr, cerr, _M_cerr, std::ios_base::in, err_fd, 0);
+#endif
+
+        open_fd();
+        _M_group = opt && spawn_opt::group;
+        _M_active = true;
+    }
+    catch(...)
+    {
+        discard(status);
+#if !defined(disable_process_redir)
+        discard(out_fd);
+        discard(in_fd);
+        discard(err_fd);
+#endif
+
+        throw;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+process process::spawn(const std::string& path, const arguments& args, app::spawn_opt opt)
+{
+    process x;
+    x._M_spawn(path, args, nullptr, opt, redir::none);
+    return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+process process::spawn_e(const environ& e, const std::string& path, const arguments& args, app::spawn_opt opt)
+{
+    process x;
+    x._M_spawn(path, args, &e, opt, redir::none);
+    return x;
+}
+
+#if !defined(disable_process_redir)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+process process::spawn(app::redir redir, const std::string& path, const arguments& args, app::spawn_opt opt)
+{
+    process x;
+    x._M_spawn(path, args, nullptr, opt, redir);
+    return x;
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool process::running()
 {
@@ -198,9 +593,20 @@ bool process::signal(app::signal x)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-static void handler(int)
+void process::_M_stop(std::chrono::milliseconds timeout, exit_func func)
 {
-    return;
+    if(running())
+    {
+        terminate();
+        stopper::instance().insert(std::move(*this), std::chrono::steady_clock::now() + timeout, std::move(func));
+    }
+    else if(func) func(_M_code);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void process::wait_stopped()
+{
+    stopper::instance().wait();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -208,33 +614,54 @@ bool process::can_join(std::chrono::seconds s, std::chrono::nanoseconds n)
 {
     if(running())
     {
-        struct sigaction sa_old, sa_new;
-        sa_new.sa_handler = handler;
-        sigemptyset(&sa_new.sa_mask);
-        sa_new.sa_flags = 0;
+        process* list[] = { this };
+        return join_any(list, 1, s, n) == 0;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t process::join_any(process* list[], std::size_t size, std::chrono::seconds s, std::chrono::nanoseconds n)
+{
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + s + n;
 
-        if(sigaction(int(app::signal::child), &sa_new, &sa_old)) throw errno_error();
+    // pidfd of the group leader stays readable after it exits, but the rest
+    // of the group may still be running, so such groups are checked periodically
+    bool tick[max_join] = { };
+    pollfd fds[max_join];
 
-        timespec time = { static_cast<std::time_t>(s.count()), static_cast<long>(n.count()) };
+    while(true)
+    {
+        std::chrono::nanoseconds timeout = until - std::chrono::steady_clock::now();
 
-        bool value = false;
-        while(nanosleep(&time, &time) == -1)
+        for(std::size_t ri = 0; ri < size; ++ri)
         {
-            if(std::errc(errno) == std::errc::interrupted)
-            {
-                if(!running())
-                {
-                    value = true;
-                    break;
-                }
-            }
-            else throw errno_error();
+            fds[ri] = pollfd { -1, POLLIN, 0 };
+            if(!list[ri]->_M_active) continue;
+
+            if(!list[ri]->running()) return ri;
+
+            if(list[ri]->_M_fd == -1 || tick[ri])
+                timeout = std::min<std::chrono::nanoseconds>(timeout, std::chrono::milliseconds(10));
+            else fds[ri].fd = list[ri]->_M_fd;
         }
 
-        if(sigaction(int(app::signal::child), &sa_old, nullptr)) throw errno_error();
-        return value;
+        if(timeout <= std::chrono::nanoseconds::zero()) return size;
+
+        std::chrono::seconds ts = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        timespec time = { static_cast<std::time_t>(ts.count()), static_cast<long>((timeout - ts).count()) };
+
+        int count = ppoll(fds, size, &time, nullptr);
+        if(count == -1)
+        {
+            if(std::errc(errno) != std::errc::interrupted) throw errno_error();
+        }
+        else if(count > 0)
+        {
+            for(std::size_t ri = 0; ri < size; ++ri)
+                if(fds[ri].revents && list[ri]->_M_group) tick[ri] = true;
+        }
     }
-    return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -282,30 +709,40 @@ int replace(const std::string& path, const arguments& args)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int replace_e(const environ& e, const std::string& path, const arguments& args)
+{
+    return replace_e(e.to_charpp().get(), path, args);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int replace_e(char* envp[], const std::string& path, const arguments& args)
 {
     charpp_ptr x = args.to_charpp(path);
-    charpp_ptr y = e.to_charpp();
 
-    if(execve(x[0], x.get(), y.get())) throw errno_error();
+    if(execve(x[0], x.get(), envp)) throw errno_error();
     return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 exit_code execute(const std::string& command)
 {
-    int code = system(command.data());
-    switch(code)
+    arguments args = arguments::split(command);
+    if(args.empty()) throw execute_error("Empty command");
+
+    std::string path = *args.begin();
+    args.erase(args.begin());
+
+    process x;
+    try
     {
-    case  -1: throw execute_error("app::execute failed");
-    case 127: throw execute_error("Could not execute shell in the child process");
-
-    default:
-        if(WIFEXITED(code))
-            return exit_code(WEXITSTATUS(code));
-        else if(WIFSIGNALED(code))
-            return exit_code(static_cast<app::signal>(WTERMSIG(code)));
-        else return exit_code();
+        x = process::spawn(path, args);
     }
+    catch(errno_error& e)
+    {
+        throw execute_error("Could not execute " + path + ": " + e.what());
+    }
+
+    x.join();
+    return x.exit_code();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -316,6 +753,62 @@ void internal::sleep_for(std::chrono::seconds s, std::chrono::nanoseconds n)
     nanosleep(&time, nullptr);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static sigset_t get_set(std::initializer_list<app::signal> x)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    for(auto ri = x.begin(); ri != x.end(); ++ri) sigaddset(&set, int(*ri));
+
+    return set;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ignore(app::signal x)
+{
+    if(std::signal(int(x), SIG_IGN) == SIG_ERR) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void block(std::initializer_list<app::signal> x)
+{
+    sigset_t set = get_set(x);
+    if(sigprocmask(SIG_BLOCK, &set, nullptr)) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void unblock(std::initializer_list<app::signal> x)
+{
+    sigset_t set = get_set(x);
+    if(sigprocmask(SIG_UNBLOCK, &set, nullptr)) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool is_blocked(app::signal x)
+{
+    sigset_t set;
+    if(sigprocmask(SIG_BLOCK, nullptr, &set)) throw errno_error();
+
+    return sigismember(&set, int(x)) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+app::signal internal::wait_for(std::initializer_list<app::signal> x, std::chrono::seconds s, std::chrono::nanoseconds n)
+{
+    sigset_t set = get_set(x);
+    timespec time = { static_cast<std::time_t>(s.count()), static_cast<long>(n.count()) };
+
+    int code = sigtimedwait(&set, nullptr, &time);
+    if(code == -1)
+    {
+        if(std::errc(errno) == std::errc::resource_unavailable_try_again
+        || std::errc(errno) == std::errc::interrupted)
+            return app::signal::none;
+        else throw errno_error();
+    }
+    return static_cast<app::signal>(code);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
@@ -16,8 +16,11 @@
 #include "filebuf.hpp"
 
 #include <chrono>
+#include <cstddef>
 #include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 
@@ -103,6 +106,19 @@ enum class redir
 };
 DECLARE_OPERATOR(redir)
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class spawn_opt
+{
+    none   = 0x00,
+    group  = 0x01, // run in a new process group
+    notify = 0x02, // leave SIGUSR1 ignored (X server will then notify its parent, when ready)
+    tied   = 0x04, // receive SIGTERM, when the parent dies
+};
+DECLARE_OPERATOR(spawn_opt)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+typedef std::function<void(const app::exit_code&)> exit_func;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class process
 {
@@ -149,6 +165,23 @@ public:
 
     ~process();
 
+    ///
+    /// \brief spawn
+    ///
+    /// Executes program in a child process created with vfork. Unlike the
+    /// constructors above, spawn does not duplicate address space of the
+    /// parent, so its cost does not depend on the parent's size. Arguments
+    /// and environment are prepared beforehand and the child only makes
+    /// system calls until exec. File descriptors other than stdin, stdout
+    /// and stderr are not inherited by the child.
+    ///
+    static process spawn(const std::string& path, const arguments& args = {}, app::spawn_opt = spawn_opt::none);
+    static process spawn_e(const environ&, const std::string& path, const arguments& args = {}, app::spawn_opt = spawn_opt::none);
+
+#if !defined(disable_process_redir)
+    static process spawn(app::redir, const std::string& path, const arguments& args = {}, app::spawn_opt = spawn_opt::none);
+#endif
+
     process& operator=(const process&) = delete;
     process& operator=(process&& x) noexcept
     {
@@ -159,6 +192,7 @@ public:
     void swap(process& x) noexcept
     {
         std::swap(_M_id, x._M_id);
+        std::swap(_M_fd, x._M_fd);
         std::swap(_M_active, x._M_active);
         std::swap(_M_group, x._M_group);
         std::swap(_M_code, x._M_code);
@@ -177,6 +211,15 @@ public:
 
     process::id get_id() const noexcept { return _M_id; }
 
+    ///
+    /// \brief get_fd
+    ///
+    /// Returns pidfd of the process or -1, if pidfd_open is not supported
+    /// by the kernel. pidfd becomes readable, when the process exits, and
+    /// can be watched with poll/epoll or QSocketNotifier.
+    ///
+    int get_fd() const noexcept { return _M_fd; }
+
     bool running();
     const app::exit_code& exit_code() const noexcept { return _M_code; }
 
@@ -196,6 +239,63 @@ public:
     }
     void join();
 
+    ///
+    /// \brief join_any
+    ///
+    /// Waits until one of the running processes in the range [first, last)
+    /// exits. Returns iterator to the process that has exited or last, if
+    /// none of them exited within the specified duration. Processes, which
+    /// are not running, are ignored. Up to max_join processes can be waited on.
+    ///
+    static constexpr std::size_t max_join = 64;
+
+    template<typename Iterator, typename Rep, typename Period>
+    static Iterator join_any(Iterator first, Iterator last, const std::chrono::duration<Rep, Period>& x)
+    {
+        std::chrono::seconds s = std::chrono::duration_cast<std::chrono::seconds>(x);
+        std::chrono::nanoseconds n = std::chrono::duration_cast<std::chrono::nanoseconds>(x - s);
+
+        process* list[max_join];
+        std::size_t size = 0;
+
+        for(Iterator ri = first; ri != last; ++ri)
+        {
+            if(size == max_join) throw std::length_error("Too many processes to join");
+            list[size++] = &*ri;
+        }
+
+        std::size_t index = join_any(list, size, s, n);
+        if(index == size) return last;
+
+        std::advance(first, index);
+        return first;
+    }
+
+    ///
+    /// \brief stop
+    ///
+    /// Sends SIGTERM to the process and returns immediately. The process is
+    /// handed over to a background thread, which kills it with SIGKILL if it
+    /// is still running after the timeout. The process object is left empty.
+    ///
+    /// Once the process has been reaped, func is called on the background
+    /// thread, not on the caller's one: it must not touch any state of the
+    /// caller without locking (or Qt objects). Use reactor::stop to get the
+    /// notification on the caller's event loop.
+    ///
+    template<typename Rep, typename Period>
+    void stop(const std::chrono::duration<Rep, Period>& timeout, exit_func func = nullptr)
+    {
+        _M_stop(std::chrono::duration_cast<std::chrono::milliseconds>(timeout), std::move(func));
+    }
+
+    ///
+    /// \brief wait_stopped
+    ///
+    /// Waits until all processes passed to stop() have been reaped.
+    ///
+    static void wait_stopped();
+
 #if !defined(disable_process_redir)
     std::ofstream cin;
     std::ifstream cout, cerr;
@@ -203,6 +303,7 @@ public:
 
 protected:
     id _M_id = 0;
+    int _M_fd = -1;
     bool _M_active = false;
     bool _M_group = false;
 
@@ -212,9 +313,15 @@ protected:
 #endif
 
     void _M_process(std::function<int()>, bool group, app::redir);
+    void _M_spawn(const std::string& path, const arguments&, const environ*, app::spawn_opt, app::redir);
 
     bool can_join(std::chrono::seconds, std::chrono::nanoseconds);
+    static std::size_t join_any(process* list[], std::size_t size, std::chrono::seconds, std::chrono::nanoseconds);
+
+    void open_fd() noexcept;
     void set_code(int code);
+
+    void _M_stop(std::chrono::milliseconds, exit_func);
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -235,8 +342,16 @@ process::id parent_id() noexcept;
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int replace(const std::string& path, const arguments& args = {});
 int replace_e(const environ&, const std::string& path, const arguments& args = {});
+int replace_e(char* envp[], const std::string& path, const arguments& args = {});
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief execute
+///
+/// Executes command and waits for it to finish. The command is split into
+/// arguments with arguments::split and executed directly (not through
+/// shell), so its first argument must be the full path to the program.
+///
 exit_code execute(const std::string& command);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -254,6 +369,32 @@ inline void sleep_for(const std::chrono::duration<Rep, Period>& x)
 template<typename Clock, typename Duration>
 inline void sleep_until(const std::chrono::time_point<Clock, Duration>& t) { sleep_for(t - Clock::now()); }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void ignore(app::signal);
+
+void block(std::initializer_list<app::signal>);
+void unblock(std::initializer_list<app::signal>);
+
+bool is_blocked(app::signal);
+
+///
+/// \brief wait_for
+///
+/// Waits for one of the (previously blocked) signals to become pending and
+/// accepts it. Returns signal::none, if none of the signals arrived within
+/// the specified duration.
+///
+namespace internal { app::signal wait_for(std::initializer_list<app::signal>, std::chrono::seconds, std::chrono::nanoseconds); }
+
+template<typename Rep, typename Period>
+inline app::signal wait_for(std::initializer_list<app::signal> x, const std::chrono::duration<Rep, Period>& t)
+{
+    std::chrono::seconds s = std::chrono::duration_cast<std::chrono::seconds>(t);
+    std::chrono::nanoseconds n = std::chrono::duration_cast<std::chrono::nanoseconds>(t - s);
+
+    return internal::wait_for(x, s, n);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 }
 
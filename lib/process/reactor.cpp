@@ -0,0 +1,190 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "errno_error.hpp"
+#include "reactor.hpp"
+
+#include <algorithm>
+
+#include <cstdint>
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace app
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+reactor::reactor()
+{
+    _M_child = this_process::is_blocked(app::signal::child);
+    this_process::block({ app::signal::child });
+
+    try
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+
+        _M_signal = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+        if(_M_signal == -1) throw errno_error();
+
+        _M_poller.insert(_M_signal, storage::event::read);
+
+        _M_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(_M_timer == -1) throw errno_error();
+
+        _M_poller.insert(_M_timer, storage::event::read);
+    }
+    catch(...)
+    {
+        if(_M_timer != -1) close(_M_timer);
+        if(_M_signal != -1) close(_M_signal);
+        if(!_M_child) this_process::unblock({ app::signal::child });
+        throw;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+reactor::~reactor()
+{
+    close(_M_timer);
+    close(_M_signal);
+
+    if(!_M_child) this_process::unblock({ app::signal::child });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void reactor::watch(app::process& process, exit_func func)
+{
+    int fd = process.get_fd();
+    if(fd != -1) _M_poller.insert(fd, storage::event::read);
+    _M_entries.push_back(entry { &process, std::move(func), fd == -1, std::chrono::steady_clock::time_point::max() });
+
+    if(fd == -1) arm(true);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void reactor::_M_stop(app::process& process, std::chrono::milliseconds timeout, exit_func func)
+{
+    if(process.running())
+    {
+        process.terminate();
+        watch(process, std::move(func));
+
+        // deadline is checked on the timer
+        _M_entries.back().until = std::chrono::steady_clock::now() + timeout;
+        arm(true);
+    }
+    else if(func) func(process.exit_code());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void reactor::unwatch(const app::process& process)
+{
+    auto ri = std::find_if(_M_entries.begin(), _M_entries.end(), [&](const entry& e){ return e.process == &process; });
+    if(ri != _M_entries.end())
+    {
+        if(!ri->tick) _M_poller.erase(process.get_fd());
+        _M_entries.erase(ri);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void reactor::arm(bool x)
+{
+    if(x == _M_armed) return;
+
+    itimerspec time = { };
+    if(x) time.it_interval.tv_nsec = time.it_value.tv_nsec = 10000000; // 10 ms
+
+    if(timerfd_settime(_M_timer, 0, &time, nullptr)) throw errno_error();
+    _M_armed = x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t reactor::dispatch()
+{
+    signalfd_siginfo info;
+    while(read(_M_signal, &info, sizeof(info)) == sizeof(info));
+
+    uint64_t ticks;
+    while(read(_M_timer, &ticks, sizeof(ticks)) == sizeof(ticks));
+
+    // pidfds, which have become readable
+    _M_poller.wait_for(std::chrono::milliseconds(0));
+    auto ready = [this](int fd)
+    {
+        return std::any_of(_M_poller.begin(), _M_poller.end(), [fd](const storage::poller::ready& x){ return x.fd == fd; });
+    };
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    std::vector<entry> done;
+    bool tick = false;
+    for(auto ri = _M_entries.begin(); ri != _M_entries.end();)
+    {
+        if(ri->process->running())
+        {
+            if(now >= ri->until)
+            {
+                ri->process->kill();
+                ri->until = std::chrono::steady_clock::time_point::max();
+            }
+
+            // group leader has exited, but the rest of the group is still
+            // running: its pidfd will stay readable, so stop watching it
+            if(!ri->tick && ready(ri->process->get_fd()))
+            {
+                _M_poller.erase(ri->process->get_fd());
+                ri->tick = true;
+            }
+            tick = tick || ri->tick || ri->until != std::chrono::steady_clock::time_point::max();
+            ++ri;
+        }
+        else
+        {
+            if(!ri->tick) _M_poller.erase(ri->process->get_fd());
+
+            done.push_back(std::move(*ri));
+            ri = _M_entries.erase(ri);
+        }
+    }
+    arm(tick);
+
+    // exit functions may watch other processes
+    for(entry& e : done) if(e.func) e.func(e.process->exit_code());
+    return done.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t reactor::_M_wait(long long timeout)
+{
+    std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while(true)
+    {
+        std::size_t count = dispatch();
+        if(count || empty()) return count;
+
+        if(timeout < 0)
+            _M_poller.wait();
+        else
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now());
+            if(left.count() <= 0) return 0;
+
+            _M_poller.wait_for(left);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
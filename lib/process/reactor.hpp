@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "process.hpp"
+#include "storage/poller.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace app
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief reactor
+///
+/// Reaps watched child processes and calls their exit functions. Process
+/// exits are detected through their pidfds and, on kernels without pidfd
+/// support, through SIGCHLD delivered to a signalfd. SIGCHLD is blocked
+/// in the calling thread for the lifetime of the reactor.
+///
+/// Pidfd of a process group leader becomes readable, when the leader exits,
+/// even though the rest of the group may still be running. Such groups
+/// (and processes without pidfd) are re-checked every 10 ms on a timerfd.
+///
+/// The reactor does not own any threads: its fd() becomes readable, when
+/// there is something to dispatch, and can be handed to QSocketNotifier
+/// (calling dispatch() from the slot) or waited on with wait()/wait_for().
+///
+/// Watched processes must not be moved or destroyed, until they have
+/// exited or have been unwatched.
+///
+class reactor
+{
+public:
+    reactor();
+    reactor(const reactor&) = delete;
+    ~reactor();
+
+    reactor& operator=(const reactor&) = delete;
+
+    void watch(app::process&, exit_func);
+    void unwatch(const app::process&);
+
+    ///
+    /// \brief stop
+    ///
+    /// Same as process::stop, but without the background thread: sends
+    /// SIGTERM to the process and watches it, killing it with SIGKILL if it
+    /// is still running after the timeout. func is called from dispatch(),
+    /// ie, on the caller's event loop. Several processes can be stopped
+    /// concurrently.
+    ///
+    template<typename Rep, typename Period>
+    void stop(app::process& process, const std::chrono::duration<Rep, Period>& timeout, exit_func func = nullptr)
+    {
+        _M_stop(process, std::chrono::duration_cast<std::chrono::milliseconds>(timeout), std::move(func));
+    }
+
+    bool empty() const noexcept { return _M_entries.empty(); }
+
+    int fd() const noexcept { return _M_poller.fd(); }
+
+    ///
+    /// \brief dispatch
+    ///
+    /// Reaps watched processes that have exited and calls their exit
+    /// functions. Does not block. Returns the number of reaped processes.
+    ///
+    std::size_t dispatch();
+
+    ///
+    /// \brief wait
+    ///
+    /// Waits until at least one of the watched processes exits and dispatches
+    /// it. Returns the number of reaped processes or 0, if nothing is being
+    /// watched (or the timeout has expired).
+    ///
+    std::size_t wait() { return _M_wait(-1); }
+
+    template<typename Rep, typename Period>
+    std::size_t wait_for(const std::chrono::duration<Rep, Period>& x)
+    {
+        return _M_wait(std::chrono::duration_cast<std::chrono::milliseconds>(x).count());
+    }
+
+private:
+    struct entry
+    {
+        app::process* process;
+        exit_func func;
+
+        // pidfd is not being watched, re-checked on the timer instead
+        bool tick;
+
+        // when to kill the process (see stop)
+        std::chrono::steady_clock::time_point until;
+    };
+    std::vector<entry> _M_entries;
+
+    storage::poller _M_poller;
+    int _M_signal = -1;
+    bool _M_child = false; // SIGCHLD was already blocked
+
+    int _M_timer = -1;
+    bool _M_armed = false;
+
+    void arm(bool);
+
+    void _M_stop(app::process&, std::chrono::milliseconds, exit_func);
+
+    std::size_t _M_wait(long long timeout);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // REACTOR_HPP
@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "atomic_file.hpp"
+#include "errno_error.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static std::string dir_name(const std::string& path)
+{
+    std::string::size_type pos = path.rfind('/');
+    if(pos == std::string::npos) return ".";
+    if(pos == 0) return "/";
+    return path.substr(0, pos);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int open_dir(const std::string& path)
+{
+    int fd = ::open(path.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1) throw errno_error();
+    return fd;
+}
+
+// some file systems can't sync directories
+static bool sync_failed(int code) { return code != 0 && code != EINVAL; }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// makes the rename durable
+static void sync_dir(const std::string& path)
+{
+    int fd = open_dir(dir_name(path));
+
+    int val;
+    do val = fsync(fd);
+    while(val == -1 && std::errc(errno) == std::errc::interrupted);
+
+    int code = val == -1 ? errno : 0;
+    ::close(fd);
+
+    if(sync_failed(code)) throw errno_error(std::error_code(code, std::generic_category()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+atomic_file::atomic_file(const std::string& path, storage::perm perm):
+    _M_path(path), _M_temp(path + "-n"),
+    _M_file(_M_temp, storage::open::write, open_opt::create | open_opt::trunc, perm)
+{ }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void atomic_file::discard() noexcept
+{
+    if(!_M_done)
+    {
+        _M_file.close();
+        ::unlink(_M_temp.data());
+        _M_done = true;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void atomic_file::rename()
+{
+    _M_file.close();
+    storage::rename(_M_temp, _M_path);
+    _M_done = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void atomic_file::commit()
+{
+    if(_M_done) throw std::logic_error("File " + _M_path + " already committed");
+
+    _M_file.sync();
+    rename();
+    sync_dir(_M_path);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef ATOMIC_FILE_HPP
+#define ATOMIC_FILE_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "file.hpp"
+#include "perm.hpp"
+
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief atomic_file
+///
+/// Crash-safe replacement of a (small) state file. Contents are written
+/// into <path>-n, which on commit() is synced to the disk and renamed over
+/// the path, after which the directory is synced too. Readers see either
+/// the old or the new contents, never a mix of the two, even if the system
+/// crashes midway.
+///
+/// If the file is destroyed without being committed, the temporary file
+/// is removed and the path is left untouched.
+///
+class atomic_file
+{
+public:
+    explicit atomic_file(const std::string& path, storage::perm = user_read_write);
+    atomic_file(const atomic_file&) = delete;
+    ~atomic_file() { discard(); }
+
+    atomic_file& operator=(const atomic_file&) = delete;
+
+    const std::string& path() const noexcept { return _M_path; }
+    storage::file& file() noexcept { return _M_file; }
+
+    void commit();
+
+private:
+    std::string _M_path, _M_temp;
+    storage::file _M_file;
+    bool _M_done = false;
+
+    void discard() noexcept;
+    void rename();
+
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // ATOMIC_FILE_HPP
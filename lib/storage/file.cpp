@@ -9,17 +9,34 @@
 #include "errno_error.hpp"
 #include "file.hpp"
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <stdexcept>
 
 #include <limits.h> // PATH_MAX
+#include <poll.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 namespace storage
 {
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool ready(int fd, bool write, std::chrono::seconds s, std::chrono::nanoseconds n)
+{
+    timespec time = { static_cast<std::time_t>(s.count()), static_cast<long>(n.count()) };
+
+    // unlike select, poll works with descriptors >= FD_SETSIZE
+    pollfd x = { fd, static_cast<short>(write ? POLLOUT : POLLIN), 0 };
+
+    int count = ppoll(&x, 1, &time, nullptr);
+    if(count == -1) throw errno_error();
+
+    return count;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 file::file(const std::string& name, storage::open open, open_opt opt, storage::perm perm)
@@ -39,11 +56,14 @@ void file::close() noexcept
             ::close(_M_fd);
         _M_fd = invalid;
     }
+    _M_pos = _M_end = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 size_t file::write(const void* buffer, size_t n)
 {
+    discard();
+
     ssize_t count = ::write(_M_fd, buffer, n);
     if(count == -1) throw errno_error();
 
@@ -53,17 +73,26 @@ size_t file::write(const void* buffer, size_t n)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 size_t file::read(std::string& string, size_t max, bool wait)
 {
-    std::unique_ptr<char[]> buffer(new char[max + 1]);
-    size_t count = read(buffer.get(), max, wait);
-    buffer[count] = '\0';
+    // read directly into the string
+    string.resize(max);
+    size_t count = max ? read(&string[0], max, wait) : 0;
 
-    string.assign(buffer.get(), count);
+    string.resize(count);
     return count;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 size_t file::read(void* buffer, size_t max, bool wait)
 {
+    if(_M_pos != _M_end)
+    {
+        size_t n = std::min(max, _M_end - _M_pos);
+        std::memcpy(buffer, _M_buffer.get() + _M_pos, n);
+
+        _M_pos += n;
+        return n;
+    }
+
     ssize_t count = 0;
     if(wait || can_read(std::chrono::seconds(0))) count = ::read(_M_fd, buffer, max);
 
@@ -72,61 +101,197 @@ size_t file::read(void* buffer, size_t max, bool wait)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-std::string file::readline(bool wait, char delim)
+size_t file::pread(void* buffer, size_t max, storage::offset offset) const
 {
-    std::string string;
+    ssize_t count = ::pread(_M_fd, buffer, max, offset);
+    if(count == -1) throw errno_error();
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t file::pwrite(const void* buffer, size_t n, storage::offset offset)
+{
+    ssize_t count = ::pwrite(_M_fd, buffer, n, offset);
+    if(count == -1) throw errno_error();
+
+    return count;
+}
 
-    for(char c;;)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t file::readv(const iovec* iov, size_t count)
+{
+    if(_M_pos != _M_end)
     {
-        size_t n = read(&c, sizeof(c), wait);
-        if(n == 0 || c == delim) break;
-        string += c;
+        // drain the read-ahead buffer first
+        size_t n = 0;
+        for(size_t ri = 0; ri < count && _M_pos != _M_end; ++ri)
+        {
+            size_t size = std::min(iov[ri].iov_len, _M_end - _M_pos);
+            std::memcpy(iov[ri].iov_base, _M_buffer.get() + _M_pos, size);
+
+            _M_pos += size;
+            n += size;
+        }
+        return n;
     }
 
-    return string;
+    ssize_t n = ::readv(_M_fd, iov, count);
+    if(n == -1) throw errno_error();
+
+    return n;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool file::getline(std::string& string, bool wait, char delim)
+size_t file::writev(const iovec* iov, size_t count)
 {
-    string.clear();
+    discard();
+
+    ssize_t n = ::writev(_M_fd, iov, count);
+    if(n == -1) throw errno_error();
 
-    for(char c;;)
+    return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t file::fill(bool wait)
+{
+    char* buffer = _M_buffer.get();
+    if(_M_pos)
     {
-        size_t n = read(&c, sizeof(c), wait);
-        if(n == 0) return string.size();
-        if(c == delim) return true;
-        string += c;
+        std::memmove(buffer, buffer + _M_pos, _M_end - _M_pos);
+        _M_end -= _M_pos;
+        _M_pos = 0;
     }
+
+    if(_M_end == _M_size)
+    {
+        // line does not fit into the buffer
+        size_t size = _M_size ? _M_size * 2 : buffer_size;
+        std::unique_ptr<char[]> x(new char[size]);
+        if(_M_end) std::memcpy(x.get(), buffer, _M_end);
+
+        _M_buffer = std::move(x);
+        _M_size = size;
+    }
+
+    ssize_t count = 0;
+    if(wait || ready(_M_fd, false, std::chrono::seconds(0), std::chrono::nanoseconds(0)))
+        count = ::read(_M_fd, _M_buffer.get() + _M_end, _M_size - _M_end);
+
+    if(count == -1) throw errno_error();
+
+    _M_end += count;
+    return count;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool file::eof()
+void file::discard()
 {
-    offset n = tell();
-    offset e = seek(0, origin::end);
+    // kernel file offset is ahead of the unread data, which
+    // can only be given back to the file, if it is seekable
+    if(_M_pos != _M_end && ::lseek(_M_fd, -static_cast<storage::offset>(_M_end - _M_pos), SEEK_CUR) == -1) return;
+    _M_pos = _M_end = 0;
+}
 
-    seek(n);
-    return n == e;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::string file::readline(bool wait, string_ref delim)
+{
+    string_ref line;
+    getline(line, wait, delim);
+
+    return line.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool file::getline(std::string& string, bool wait, string_ref delim)
+{
+    string_ref line;
+    bool found = getline(line, wait, delim);
+
+    string.assign(line.data(), line.size());
+    return found;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool file::getline(string_ref& line, bool wait, string_ref delim)
+{
+    if(delim.empty()) throw std::invalid_argument("Empty delimiter");
+
+    // where to resume the search (relative to _M_pos)
+    // after more data has been read into the buffer
+    size_t from = 0;
+    while(true)
+    {
+        const char* head = _M_buffer.get() + _M_pos;
+        const char* tail = _M_buffer.get() + _M_end;
+        const char* ri = tail;
+
+        // buffer is null until the first fill
+        if(head + from != tail)
+        {
+            if(delim.size() == 1)
+            {
+                ri = static_cast<const char*>(std::memchr(head + from, delim[0], tail - head - from));
+                if(ri == nullptr) ri = tail;
+            }
+            else ri = std::search(head + from, tail, delim.begin(), delim.end());
+        }
+
+        if(ri != tail)
+        {
+            line = string_ref(head, ri - head);
+            _M_pos += ri - head + delim.size();
+            return true;
+        }
+
+        size_t size = tail - head;
+        from = size < delim.size() ? 0 : size - delim.size() + 1;
+
+        if(fill(wait) == 0)
+        {
+            line = string_ref(_M_buffer.get() + _M_pos, _M_end - _M_pos);
+            _M_pos = _M_end;
+            return line.size();
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool file::eof()
+{
+    return _M_pos == _M_end && tell() >= size();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 offset file::seek(storage::offset offset, storage::origin origin)
 {
+    // unread data is discarded
+    if(origin == origin::cur) offset -= _M_end - _M_pos;
+
     storage::offset n = ::lseek(_M_fd, offset, static_cast<int>(origin));
     if(n == -1) throw errno_error();
 
+    _M_pos = _M_end = 0;
     return n;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+offset file::tell()
+{
+    storage::offset n = ::lseek(_M_fd, 0, SEEK_CUR);
+    if(n == -1) throw errno_error();
+
+    return n - (_M_end - _M_pos);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 offset file::size()
 {
-    offset n = tell();
-    offset e = seek(0, origin::end);
+    struct stat x;
+    if(fstat(_M_fd, &x)) throw errno_error();
 
-    seek(n);
-    return e;
+    return x.st_size;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -137,33 +302,33 @@ void file::truncate(storage::offset length)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-bool file::can_read(std::chrono::seconds s, std::chrono::nanoseconds n)
+void file::prefetch(storage::offset offset, storage::offset n)
 {
-    timespec time = { static_cast<std::time_t>(s.count()), static_cast<long>(n.count()) };
+    // returns error code instead of setting errno
+    int code = posix_fadvise(_M_fd, offset, n, POSIX_FADV_WILLNEED);
+    if(code) throw errno_error(std::error_code(code, std::generic_category()));
+}
 
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(_M_fd, &fds);
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void file::sync(bool data_only)
+{
+    int val;
+    do val = data_only ? fdatasync(_M_fd) : fsync(_M_fd);
+    while(val == -1 && std::errc(errno) == std::errc::interrupted);
 
-    int count = pselect(_M_fd+1, &fds, 0, 0, &time, nullptr);
-    if(count == -1) throw errno_error();
+    if(val == -1) throw errno_error();
+}
 
-    return count;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool file::can_read(std::chrono::seconds s, std::chrono::nanoseconds n)
+{
+    return _M_pos != _M_end || ready(_M_fd, false, s, n);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool file::can_write(std::chrono::seconds s, std::chrono::nanoseconds n)
 {
-    timespec time = { static_cast<std::time_t>(s.count()), static_cast<long>(n.count()) };
-
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(_M_fd, &fds);
-
-    int count = pselect(_M_fd+1, 0, &fds, 0, &time, nullptr);
-    if(count == -1) throw errno_error();
-
-    return count;
+    return ready(_M_fd, true, s, n);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -188,6 +353,12 @@ void rename(const std::string& prev, const std::string& name)
     if(::rename(prev.data(), name.data())) throw errno_error();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void link(const std::string& prev, const std::string& name)
+{
+    if(::link(prev.data(), name.data())) throw errno_error();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 std::string real_path(const std::string& path)
 {
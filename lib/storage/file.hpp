@@ -12,14 +12,18 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "enum.hpp"
 #include "perm.hpp"
+#include "string.hpp"
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -45,6 +49,8 @@ typedef off_t offset;
 typedef uid_t uid;
 typedef gid_t gid;
 
+using app::string_ref;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 enum class open
 {
@@ -58,6 +64,7 @@ enum class open_opt
 {
     none   = 0,
     create = O_CREAT,
+    excl   = O_EXCL,
     trunc  = O_TRUNC,
     append = O_APPEND,
     sync   = O_SYNC,
@@ -105,6 +112,11 @@ public:
     void swap(file& x) noexcept
     {
         std::swap(_M_fd, x._M_fd);
+
+        std::swap(_M_buffer, x._M_buffer);
+        std::swap(_M_size, x._M_size);
+        std::swap(_M_pos, x._M_pos);
+        std::swap(_M_end, x._M_end);
     }
 
     size_t write(const std::string& string)
@@ -114,16 +126,57 @@ public:
     size_t read(std::string& string, size_t max, bool wait = true);
     size_t read(void* buffer, size_t max, bool wait = true);
 
-    std::string readline(bool wait = true, char delim = '\n');
-    bool getline(std::string& string, bool wait = true, char delim = '\n');
+    ///
+    /// Positional I/O does not use or change the file offset,
+    /// so several readers can share the file. It bypasses
+    /// the read-ahead buffer.
+    ///
+    size_t pread(void* buffer, size_t max, storage::offset) const;
+    size_t pwrite(const void* buffer, size_t n, storage::offset);
+
+    ///
+    /// Scatter/gather I/O: reads into or writes from several
+    /// buffers in one system call.
+    ///
+    size_t readv(const iovec*, size_t count);
+    size_t writev(const iovec*, size_t count);
+
+    ///
+    /// readline and getline read ahead into an internal buffer, which is also
+    /// used by subsequent reads. Data in the buffer makes can_read return true.
+    /// Delimiters can be longer than one character (eg, "\r\n").
+    ///
+    /// With wait = false, only the data that is already available is read,
+    /// and a partial line is returned if the delimiter has not arrived yet.
+    ///
+    std::string readline(bool wait = true, char delim = '\n') { return readline(wait, string_ref(&delim, 1)); }
+    std::string readline(bool wait, string_ref delim);
+
+    bool getline(std::string& string, bool wait = true, char delim = '\n') { return getline(string, wait, string_ref(&delim, 1)); }
+    bool getline(std::string& string, bool wait, string_ref delim);
+
+    ///
+    /// Zero-copy version of getline: line refers to the internal buffer
+    /// and remains valid until the next read from the file.
+    ///
+    bool getline(string_ref& line, bool wait = true, char delim = '\n') { return getline(line, wait, string_ref(&delim, 1)); }
+    bool getline(string_ref& line, bool wait, string_ref delim);
+
     bool eof();
 
     storage::offset seek(storage::offset, storage::origin = origin::beg);
-    storage::offset tell() { return seek(0, origin::cur); }
+    storage::offset tell();
     storage::offset size();
 
     void truncate(storage::offset length);
 
+    // start reading n bytes (0 = up to the end) into the page cache
+    // in the background, without copying them anywhere
+    void prefetch(storage::offset = 0, storage::offset n = 0);
+
+    // flush file data (and metadata, unless data_only) to the disk
+    void sync(bool data_only = false);
+
     template<typename Rep, typename Period>
     bool can_read(const std::chrono::duration<Rep, Period>& x)
     {
@@ -142,11 +195,23 @@ public:
 
     file::id get_id() const { return _M_fd; }
 
+    // read-ahead buffer holds unread data
+    bool buffered() const noexcept { return _M_pos != _M_end; }
+
     int control(int request, void* buffer);
 
 protected:
     file::id _M_fd = invalid;
 
+    // read-ahead buffer, unread data is in [_M_pos, _M_end)
+    static constexpr size_t buffer_size = 4096;
+
+    std::unique_ptr<char[]> _M_buffer;
+    size_t _M_size = 0, _M_pos = 0, _M_end = 0;
+
+    size_t fill(bool wait);
+    void discard();
+
     bool can_read(std::chrono::seconds, std::chrono::nanoseconds);
     bool can_write(std::chrono::seconds, std::chrono::nanoseconds);
 };
@@ -155,6 +220,7 @@ protected:
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void remove(const std::string& name);
 void rename(const std::string& prev, const std::string& name);
+void link(const std::string& prev, const std::string& name);
 std::string real_path(const std::string& path);
 
 void chown(const std::string& name, storage::uid, storage::gid, bool deref = true);
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "errno_error.hpp"
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstdint>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mapped_file::mapped_file(const std::string& name, storage::advice advice)
+{
+    // file can be closed once it has been mapped
+    storage::file file(name, storage::open::read);
+    map(file.get_id(), advice);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mapped_file::mapped_file(const storage::file& file, storage::advice advice)
+{
+    map(file.get_id(), advice);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mapped_file::map(int fd, storage::advice advice)
+{
+    struct stat x;
+    if(fstat(fd, &x)) throw errno_error();
+
+    _M_size = x.st_size;
+    if(_M_size == 0)
+    {
+        _M_data = "";
+        return;
+    }
+
+    void* data = mmap(nullptr, _M_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) throw errno_error();
+
+    _M_data = static_cast<const char*>(data);
+    if(advice != storage::advice::normal)
+    {
+        try
+        {
+            this->advise(advice);
+        }
+        catch(...)
+        {
+            close();
+            throw;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mapped_file::close() noexcept
+{
+    if(_M_size) munmap(const_cast<char*>(_M_data), _M_size);
+
+    _M_data = nullptr;
+    _M_size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mapped_file::advise(storage::advice advice)
+{
+    advise(advice, 0, _M_size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mapped_file::advise(storage::advice advice, size_t offset, size_t size)
+{
+    if(offset >= _M_size || size == 0) return;
+    if(size > _M_size - offset) size = _M_size - offset;
+
+    // madvise wants the address aligned to the page size
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(_M_data) + offset;
+    uintptr_t head = addr & ~(page - 1);
+
+    if(madvise(reinterpret_cast<void*>(head), size + (addr - head), static_cast<int>(advice)))
+    {
+        if(advice == storage::advice::huge_page && errno == EINVAL) return;
+        throw errno_error();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "file.hpp"
+#include "string.hpp"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include <sys/mman.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class advice
+{
+    normal     = MADV_NORMAL,
+    sequential = MADV_SEQUENTIAL,
+    random     = MADV_RANDOM,
+    will_need  = MADV_WILLNEED,
+    huge_page  = MADV_HUGEPAGE,
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief mapped_file
+///
+/// Read-only view of the whole file mapped into memory, which allows
+/// to parse the file in place without copying it. The view is taken
+/// when the file is mapped: it does not grow with the file.
+///
+class mapped_file
+{
+public:
+    typedef const char* const_iterator;
+
+public:
+    mapped_file() noexcept = default;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file(mapped_file&& x) noexcept { swap(x); }
+
+    explicit mapped_file(const std::string& name, storage::advice = advice::normal);
+    explicit mapped_file(const storage::file&, storage::advice = advice::normal);
+
+    ~mapped_file() { close(); }
+
+    void close() noexcept;
+    bool is_open() const noexcept { return _M_data != nullptr; }
+
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file& operator=(mapped_file&& x) noexcept
+    {
+        swap(x);
+        return (*this);
+    }
+
+    void swap(mapped_file& x) noexcept
+    {
+        std::swap(_M_data, x._M_data);
+        std::swap(_M_size, x._M_size);
+    }
+
+    ///
+    /// \brief advise
+    ///
+    /// Tells the kernel how the mapping is going to be accessed. huge_page
+    /// is only a hint and is silently ignored, where it is not supported.
+    ///
+    void advise(storage::advice);
+    void advise(storage::advice, size_t offset, size_t size);
+
+    ////////////////////
+    const char* data() const noexcept { return _M_data; }
+    size_t size() const noexcept { return _M_size; }
+    bool empty() const noexcept { return _M_size == 0; }
+
+    const_iterator begin() const noexcept { return _M_data; }
+    const_iterator end() const noexcept { return _M_data + _M_size; }
+
+    string_ref view() const noexcept { return string_ref(_M_data, _M_size); }
+
+private:
+    // empty files cannot be mapped, they point to ""
+    const char* _M_data = nullptr;
+    size_t _M_size = 0;
+
+    void map(int fd, storage::advice);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // MAPPED_FILE_HPP
@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "errno_error.hpp"
+#include "poller.hpp"
+
+#include <algorithm>
+#include <climits>
+
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+poller::poller()
+{
+    _M_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(_M_fd == -1) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+poller::~poller()
+{
+    if(_M_fd != -1) ::close(_M_fd);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void control(int epoll, int op, int fd, storage::event x)
+{
+    epoll_event event = { };
+    event.events = static_cast<uint32_t>(x);
+    event.data.fd = fd;
+
+    if(epoll_ctl(epoll, op, fd, &event)) throw errno_error();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void poller::insert(int fd, storage::event x)
+{
+    control(_M_fd, EPOLL_CTL_ADD, fd, x);
+}
+
+void poller::insert(const storage::file& file, storage::event x)
+{
+    _M_files.emplace_back(&file, x);
+    try
+    {
+        insert(file.get_id(), x);
+    }
+    catch(...)
+    {
+        _M_files.pop_back();
+        throw;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void poller::modify(int fd, storage::event x)
+{
+    control(_M_fd, EPOLL_CTL_MOD, fd, x);
+}
+
+void poller::modify(const storage::file& file, storage::event x)
+{
+    modify(file.get_id(), x);
+    for(auto& f : _M_files) if(f.first == &file) f.second = x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void poller::erase(int fd) noexcept
+{
+    epoll_ctl(_M_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+    _M_files.erase(std::remove_if(_M_files.begin(), _M_files.end(),
+        [fd](const watch& f) { return f.first->get_id() == fd; }),
+    _M_files.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t poller::_M_wait(long long timeout)
+{
+    // buffered data is ready now, but
+    // the kernel fd may stay quiet
+    auto buffered = [](const watch& f)
+        { return (f.second && event::read) && f.first->buffered(); };
+
+    if(std::any_of(_M_files.begin(), _M_files.end(), buffered)) timeout = 0;
+    if(timeout > INT_MAX) timeout = INT_MAX;
+
+    epoll_event events[max_ready];
+    int count;
+
+    do count = epoll_wait(_M_fd, events, max_ready, timeout < 0 ? -1 : static_cast<int>(timeout));
+    while(count == -1 && std::errc(errno) == std::errc::interrupted);
+
+    if(count == -1) throw errno_error();
+
+    for(int ri = 0; ri < count; ++ri)
+        _M_ready[ri] = ready { events[ri].data.fd, static_cast<storage::event>(events[ri].events) };
+
+    _M_count = count;
+
+    for(const auto& f : _M_files)
+        if(buffered(f))
+        {
+            ready* ri = std::find_if(_M_ready, _M_ready + _M_count, [&](const ready& x){ return x.fd == f.first->get_id(); });
+            if(ri != _M_ready + _M_count)
+                ri->events = ri->events | event::read;
+
+            // the rest is reported on the next wait
+            else if(_M_count < max_ready)
+                _M_ready[_M_count++] = ready { f.first->get_id(), event::read };
+        }
+
+    return _M_count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "enum.hpp"
+#include "file.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace storage
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class event
+{
+    none   = 0,
+    read   = EPOLLIN,
+    write  = EPOLLOUT,
+    error  = EPOLLERR, // always reported
+    hangup = EPOLLHUP, // always reported
+};
+DECLARE_OPERATOR(event)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief poller
+///
+/// Waits on many file descriptors (files, pipes, pidfds, etc) at once
+/// using epoll. Its own fd() becomes readable, when any of them is ready,
+/// so the poller can be nested in another event loop (eg, QSocketNotifier).
+///
+/// Results of the last wait are available through operator[] and
+/// iterators and stay valid until the next wait.
+///
+/// storage::file inserted as such (rather than by its fd) is also reported
+/// readable while its read-ahead buffer holds data, which epoll can't see.
+/// Such file has to be erased from the poller before it is closed, moved
+/// or destroyed.
+///
+class poller
+{
+public:
+    struct ready
+    {
+        int fd;
+        storage::event events;
+    };
+    typedef const ready* const_iterator;
+
+    // max number of results returned by one wait
+    static constexpr size_t max_ready = 32;
+
+public:
+    poller();
+    poller(const poller&) = delete;
+    poller(poller&& x) noexcept { swap(x); }
+    ~poller();
+
+    poller& operator=(const poller&) = delete;
+    poller& operator=(poller&& x) noexcept
+    {
+        swap(x);
+        return (*this);
+    }
+
+    void swap(poller& x) noexcept
+    {
+        std::swap(_M_fd, x._M_fd);
+        for(size_t ri = 0; ri < max_ready; ++ri) std::swap(_M_ready[ri], x._M_ready[ri]);
+        std::swap(_M_count, x._M_count);
+        std::swap(_M_files, x._M_files);
+    }
+
+    ////////////////////
+    void insert(int fd, storage::event);
+    void insert(const storage::file&, storage::event);
+
+    void modify(int fd, storage::event);
+    void modify(const storage::file&, storage::event);
+
+    void erase(int fd) noexcept;
+    void erase(const storage::file& file) noexcept { erase(file.get_id()); }
+
+    int fd() const noexcept { return _M_fd; }
+
+    ////////////////////
+    ///
+    /// \brief wait
+    ///
+    /// Waits until at least one of the descriptors is ready or the timeout
+    /// expires. Returns number of ready descriptors (0 on timeout).
+    ///
+    size_t wait() { return _M_wait(-1); }
+
+    template<typename Rep, typename Period>
+    size_t wait_for(const std::chrono::duration<Rep, Period>& x)
+    {
+        return _M_wait(std::chrono::duration_cast<std::chrono::milliseconds>(x).count());
+    }
+
+    ////////////////////
+    size_t size() const noexcept { return _M_count; }
+    const ready& operator[](size_t n) const noexcept { return _M_ready[n]; }
+
+    const_iterator begin() const noexcept { return _M_ready; }
+    const_iterator end() const noexcept { return _M_ready + _M_count; }
+
+private:
+    int _M_fd = -1;
+
+    ready _M_ready[max_ready];
+    size_t _M_count = 0;
+
+    // files, whose read-ahead buffers are checked on each wait
+    typedef std::pair<const storage::file*, storage::event> watch;
+    std::vector<watch> _M_files;
+
+    size_t _M_wait(long long timeout);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // POLLER_HPP
@@ -14,7 +14,10 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstddef>
+#include <cstring>
 #include <memory>
+#include <ostream>
 #include <string>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,6 +42,78 @@ inline std::unique_ptr<char[]> clone(const std::string& value)
     return buffer;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief string_ref
+///
+/// Non-owning reference to a sequence of characters (similar to
+/// std::experimental::string_view). Allows to look up strings by
+/// std::string, char* or a part of another string without copying.
+///
+/// The referenced characters must outlive string_ref.
+///
+class string_ref
+{
+public:
+    typedef std::size_t size_type;
+    typedef const char* const_iterator;
+
+    static constexpr size_type npos = size_type(-1);
+
+public:
+    constexpr string_ref() noexcept = default;
+    constexpr string_ref(const char* x, size_type n) noexcept: _M_data(x), _M_size(n) { }
+
+    string_ref(const char* x) noexcept: _M_data(x), _M_size(std::strlen(x)) { }
+    string_ref(const std::string& x) noexcept: _M_data(x.data()), _M_size(x.size()) { }
+
+    ////////////////////
+    constexpr const char* data() const noexcept { return _M_data; }
+    constexpr size_type size() const noexcept { return _M_size; }
+    constexpr bool empty() const noexcept { return _M_size == 0; }
+
+    constexpr const_iterator begin() const noexcept { return _M_data; }
+    constexpr const_iterator end() const noexcept { return _M_data + _M_size; }
+
+    constexpr char operator[](size_type n) const noexcept { return _M_data[n]; }
+
+    ////////////////////
+    std::string str() const { return std::string(_M_data, _M_size); }
+    explicit operator std::string() const { return str(); }
+
+    string_ref substr(size_type pos, size_type n = npos) const noexcept
+    {
+        pos = std::min(pos, _M_size);
+        return string_ref(_M_data + pos, std::min(n, _M_size - pos));
+    }
+
+    size_type find(char c, size_type pos = 0) const noexcept
+    {
+        if(pos >= _M_size) return npos;
+
+        const void* x = std::memchr(_M_data + pos, c, _M_size - pos);
+        return x ? static_cast<const char*>(x) - _M_data : npos;
+    }
+
+    int compare(string_ref x) const noexcept
+    {
+        int code = std::memcmp(_M_data, x._M_data, std::min(_M_size, x._M_size));
+        return code ? code : _M_size < x._M_size ? -1 : _M_size > x._M_size ? 1 : 0;
+    }
+
+    ////////////////////
+    friend bool operator==(string_ref x, string_ref y) noexcept { return x._M_size == y._M_size && x.compare(y) == 0; }
+    friend bool operator!=(string_ref x, string_ref y) noexcept { return !(x == y); }
+    friend bool operator<(string_ref x, string_ref y) noexcept { return x.compare(y) < 0; }
+
+    friend std::ostream& operator<<(std::ostream& stream, string_ref x) { return stream.write(x._M_data, x._M_size); }
+
+private:
+    const char* _M_data = "";
+    size_type _M_size = 0;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 enum class whence
@@ -0,0 +1,245 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "errno_error.hpp"
+#include "process/process.hpp"
+#include "storage/atomic_file.hpp"
+#include "storage/file.hpp"
+#include "x11/authority.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include <limits.h> // HOST_NAME_MAX, IOV_MAX
+#include <sys/uio.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace x11
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void authority::erase(x11::family family, const std::string& address, const std::string& number)
+{
+    _M_c.erase(std::remove_if(_M_c.begin(), _M_c.end(), [&](const xauth& x)
+    {
+        return x.family == family && x.address == address && x.number == number;
+    }),
+    _M_c.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// all fields are stored in network byte order,
+// strings are prefixed with their 16-bit length
+static uint16_t get_short(app::string_ref buffer, size_t& pos)
+{
+    if(pos + 2 > buffer.size()) throw std::runtime_error("Truncated Xauthority record");
+
+    uint16_t x = (static_cast<unsigned char>(buffer[pos]) << 8) | static_cast<unsigned char>(buffer[pos + 1]);
+    pos += 2;
+    return x;
+}
+
+static std::string get_string(app::string_ref buffer, size_t& pos)
+{
+    size_t n = get_short(buffer, pos);
+    if(pos + n > buffer.size()) throw std::runtime_error("Truncated Xauthority record");
+
+    std::string x(buffer.data() + pos, n);
+    pos += n;
+    return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static iovec put_short(unsigned char*& head, uint16_t x)
+{
+    head[0] = x >> 8;
+    head[1] = x & 0xff;
+
+    iovec io = { head, 2 };
+    head += 2;
+    return io;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void write_all(storage::file& file, iovec* iov, size_t count)
+{
+    while(count)
+    {
+        size_t n = file.writev(iov, std::min<size_t>(count, IOV_MAX));
+
+        // skip what has been written
+        for(; count && n >= iov->iov_len; ++iov, --count) n -= iov->iov_len;
+        if(n)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// real files hold a handful of records
+static constexpr size_t max_file_size = 1 << 20;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void authority::read(const std::string& path)
+{
+    // the file may be owned by the user, who can truncate it at any time,
+    // so it is read into memory rather than mapped (which would raise SIGBUS)
+    // and its size is only used as a hint
+    storage::file file(path, storage::open::read);
+
+    std::string data(std::min<storage::offset>(std::max<storage::offset>(file.size(), 0), max_file_size) + 1, '\0');
+    size_t total = 0;
+    while(true)
+    {
+        if(total == data.size())
+        {
+            if(total > max_file_size) throw std::runtime_error("Xauthority file " + path + " is too large");
+            data.resize(std::min(total * 2, max_file_size + 1));
+        }
+
+        size_t n = file.pread(&data[total], data.size() - total, total);
+        if(n == 0) break;
+
+        total += n;
+    }
+    data.resize(total);
+    app::string_ref buffer(data);
+
+    for(size_t pos = 0; pos < buffer.size();)
+    {
+        xauth x;
+        x.family = static_cast<x11::family>(get_short(buffer, pos));
+        x.address = get_string(buffer, pos);
+        x.number = get_string(buffer, pos);
+        x.name = get_string(buffer, pos);
+        x.data = get_string(buffer, pos);
+
+        insert(std::move(x));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void authority::write(storage::file& file) const
+{
+    // each record is 9 fields: family and 4 strings prefixed with
+    // their length, written straight from the records with writev
+    const size_t fields = 9;
+
+    std::vector<unsigned char> shorts(size() * 5 * 2);
+    std::vector<iovec> iov;
+    iov.reserve(size() * fields);
+
+    unsigned char* head = shorts.data();
+    for(const xauth& x : _M_c)
+    {
+        iov.push_back(put_short(head, static_cast<uint16_t>(x.family)));
+
+        for(const std::string* field : { &x.address, &x.number, &x.name, &x.data })
+        {
+            if(field->size() > 0xffff) throw std::length_error("Xauthority field too long");
+
+            iov.push_back(put_short(head, field->size()));
+            iov.push_back(iovec { const_cast<char*>(field->data()), field->size() });
+        }
+    }
+
+    write_all(file, iov.data(), iov.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void authority::write(const std::string& path) const
+{
+    storage::atomic_file file(path);
+    write(file.file());
+    file.commit();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool try_lock(const std::string& path_c, const std::string& path_l)
+{
+    if(!storage::exists(path_c))
+    {
+        try
+        {
+            storage::file file(path_c, storage::open::write,
+                               storage::open_opt::create | storage::open_opt::excl,
+                               storage::user_read_write);
+        }
+        catch(errno_error& e)
+        {
+            if(e.code() != std::errc::file_exists) throw;
+        }
+    }
+
+    try
+    {
+        storage::link(path_c, path_l);
+        return true;
+    }
+    catch(errno_error& e)
+    {
+        if(e.code() != std::errc::file_exists) throw;
+        return false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+authority_lock::authority_lock(const std::string& path):
+    _M_path(path)
+{
+    std::string path_c = path + "-c", path_l = path + "-l";
+
+    for(int ri = 0; ri < 20; ++ri)
+    {
+        if(try_lock(path_c, path_l)) return;
+        app::this_process::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // lock is stale (its owner must have died), break it
+    ::unlink(path_l.data());
+    ::unlink(path_c.data());
+
+    if(!try_lock(path_c, path_l)) throw std::runtime_error("Could not lock " + path);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+authority_lock::~authority_lock()
+{
+    ::unlink((_M_path + "-c").data());
+    ::unlink((_M_path + "-l").data());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::string display_number(const std::string& name)
+{
+    std::string::size_type pos = name.rfind(':');
+    if(pos == std::string::npos) throw std::invalid_argument("Invalid display name " + name);
+
+    return name.substr(pos + 1, name.find('.', pos) - pos - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::string host_name()
+{
+    char buffer[HOST_NAME_MAX + 1];
+    if(gethostname(buffer, sizeof(buffer))) throw errno_error();
+
+    buffer[HOST_NAME_MAX] = '\0';
+    return buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014 Dimitry Ishenko
+// Distributed under the GNU GPL v2. For full terms please visit:
+// http://www.gnu.org/licenses/gpl.html
+//
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef AUTHORITY_HPP
+#define AUTHORITY_HPP
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "container.hpp"
+#include "storage/atomic_file.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+namespace x11
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class family: uint16_t
+{
+    internet  = 0,
+    decnet    = 1,
+    chaos     = 2,
+    internet6 = 6,
+    local     = 256,
+    wild      = 65535
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief Xauthority record
+///
+/// Equivalent of the Xauth structure from libXau.
+///
+struct xauth
+{
+    x11::family family = x11::family::local;
+    std::string address;
+    std::string number;
+    std::string name;
+    std::string data;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief Xauthority file
+///
+/// Reads and writes Xauthority files in the binary format used by libXau,
+/// so that no xauth process needs to be run.
+///
+class authority: public container<std::vector<xauth>>
+{
+public:
+    authority() = default;
+    authority(const authority&) = default;
+    authority(authority&&) = default;
+
+    authority& operator=(const authority&) = default;
+    authority& operator=(authority&&) = default;
+
+    ////////////////////
+    using container::insert;
+    using container::erase;
+
+    // erase all records for the display
+    void erase(x11::family, const std::string& address, const std::string& number);
+
+    ////////////////////
+    void read(const std::string& path);
+
+    // write to a temporary file and rename it over the path (see storage::atomic_file)
+    void write(const std::string& path) const;
+
+private:
+    void write(storage::file&) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// \brief authority_lock
+///
+/// Locks Xauthority file using the same protocol as XauLockAuth
+/// (<path>-c and <path>-l lock files), which is also honored by xauth.
+///
+class authority_lock
+{
+public:
+    explicit authority_lock(const std::string& path);
+    authority_lock(const authority_lock&) = delete;
+    ~authority_lock();
+
+    authority_lock& operator=(const authority_lock&) = delete;
+
+private:
+    std::string _M_path;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+std::string display_number(const std::string& name);
+std::string host_name();
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif // AUTHORITY_HPP
@@ -6,6 +6,8 @@
 // Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "storage/file.hpp"
+#include "x11/authority.hpp"
 #include "x11/server.hpp"
 
 #include <algorithm>
@@ -48,40 +50,123 @@ std::string cookie::value() const noexcept
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const std::string server::default_name = ":0";
+const std::chrono::milliseconds server::default_timeout = std::chrono::seconds(10);
 
 const std::string xorg_path = "/usr/bin/X";
-const std::string xauth_path = "/usr/bin/xauth";
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-server::server(const std::string& name, const std::string& server_auth, const app::arguments& args):
-    _M_name(name)
+std::string server::free_name(int from)
+{
+    for(int n = from; n < 256; ++n)
+    {
+        std::string x = std::to_string(n);
+        if(!storage::exists("/tmp/.X" + x + "-lock") && !storage::exists("/tmp/.X11-unix/X" + x)) return ":" + x;
+    }
+    throw std::runtime_error("No free display found");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+server::server(defer_t, const std::string& name, const std::string& server_auth, const app::arguments& args, std::chrono::milliseconds timeout):
+    _M_name(name), _M_auth(server_auth), _M_timeout(timeout)
 {
     set_cookie(server_auth);
     this_environ::insert("XAUTHORITY", server_auth);
 
+    // server resets are driven by server::reset
     arguments xorg_args;
     xorg_args.insert(name);
     xorg_args.insert(args);
-    xorg_args.insert({ "-auth", server_auth });
-
-    _M_process = process(process::group, this_process::replace, xorg_path, xorg_args);
+    xorg_args.insert({ "-auth", server_auth, "-noreset" });
+
+    // X server sends SIGUSR1 to its parent, when it is ready to accept
+    // connections, if it has inherited SIGUSR1 set to SIG_IGN (spawn_opt::notify)
+    //
+    // signals stay blocked until wait() returns
+    //
+    // X server is terminated, if camel dies without stopping it
+    block();
+    try
+    {
+        _M_launch = std::chrono::steady_clock::now();
+        _M_process = process::spawn(xorg_path, xorg_args, spawn_opt::group | spawn_opt::notify | spawn_opt::tied);
+    }
+    catch(...)
+    {
+        unblock();
+        throw;
+    }
+}
 
-    for(int ri = 0; ri < 10; ++ri)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void server::wait()
+{
+    if(_M_pending)
     {
-        this_process::sleep_for(std::chrono::seconds(1));
+        try
+        {
+            if(_M_process.running()) wait_ready();
+        }
+        catch(...)
+        {
+            unblock();
+            throw;
+        }
+        unblock();
+    }
+    if(!_M_display) throw std::runtime_error("X server failed to start");
+}
 
-        if(!_M_process.running()) throw std::runtime_error("X server failed to start");
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void server::block()
+{
+    // SIGCHLD may be blocked by someone else (eg, app::reactor)
+    _M_child = this_process::is_blocked(app::signal::child);
+
+    this_process::block({ app::signal::user1, app::signal::child });
+    _M_pending = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void server::unblock()
+{
+    _M_pending = false;
 
-        _M_display = XOpenDisplay(_M_name.data());
-        if(_M_display) break;
+    this_process::unblock({ app::signal::user1 });
+    if(!_M_child) this_process::unblock({ app::signal::child });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void server::wait_ready()
+{
+    using namespace std::chrono;
+
+    steady_clock::time_point until = _M_launch + _M_timeout;
+    for(steady_clock::time_point now = steady_clock::now(); now < until; now = steady_clock::now())
+    {
+        app::signal x = this_process::wait_for({ app::signal::user1, app::signal::child }, until - now);
+        if(x == app::signal::user1)
+        {
+            _M_display = XOpenDisplay(_M_name.data());
+            if(_M_display) break;
+        }
+        else if(x == app::signal::child)
+        {
+            if(!_M_process.running()) throw std::runtime_error("X server failed to start");
+        }
     }
 
+    // last resort for X servers that don't notify their parent
+    if(!_M_display) _M_display = XOpenDisplay(_M_name.data());
     if(!_M_display) throw std::runtime_error("X server failed to initialize");
+
+    _M_startup = duration_cast<milliseconds>(steady_clock::now() - _M_launch);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void server::close()
 {
+    if(_M_pending) unblock();
+
     if(_M_process.running())
     {
         if(_M_display)
@@ -90,29 +175,49 @@ void server::close()
             _M_display = nullptr;
         }
 
-        _M_process.signal(app::signal::hangup);
+        _M_process.stop(std::chrono::seconds(3));
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void server::reset()
+{
+    if(!_M_process.running()) throw std::runtime_error("X server is not running");
+
+    _M_cookie = x11::cookie();
+    set_cookie(_M_auth);
+
+    if(_M_display)
+    {
+        XCloseDisplay(_M_display);
+        _M_display = nullptr;
+    }
+
+    block();
+
+    _M_launch = std::chrono::steady_clock::now();
+    _M_process.signal(app::signal::hangup);
+    wait();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void server::set_cookie(const std::string& path)
 {
-#if !defined(disable_process_redir)
-    process xauth(redir::cin, this_process::replace, xauth_path, arguments { "-q", "-f", path });
-
-    xauth.cin << "remove " << name() << std::endl;
-    xauth.cin << "add " << name() << " . " << _M_cookie.value() << std::endl;
-    xauth.cin << "exit" << std::endl;
-    xauth.join();
-
-    if(xauth.exit_code().code()) throw std::runtime_error("Could not set server auth");
-#else
-    std::string xauth = xauth_path + " -q -f " + path;
-
-    if(app::this_process::execute(xauth + " remove " + name()).code()
-    || app::this_process::execute(xauth + " add " + name() + " . " + _M_cookie.value()).code())
-    throw std::runtime_error("Could not set server auth");
-#endif
+    authority_lock lock(path);
+
+    authority auth;
+    if(storage::exists(path)) auth.read(path);
+
+    xauth x;
+    x.family = family::local;
+    x.address = host_name();
+    x.number = display_number(name());
+    x.name = "MIT-MAGIC-COOKIE-1";
+    x.data = _M_cookie.data();
+
+    auth.erase(x.family, x.address, x.number);
+    auth.insert(std::move(x));
+    auth.write(path);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
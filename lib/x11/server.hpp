@@ -12,6 +12,7 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "process/process.hpp"
 
+#include <chrono>
 #include <string>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -30,6 +31,7 @@ class cookie
 public:
     cookie();
     std::string value() const noexcept;
+    std::string data() const { return std::string(_M_value, sizeof(_M_value)); }
 
 private:
     char _M_value[16];
@@ -40,6 +42,12 @@ class server
 {
 public:
     static const std::string default_name;
+    static const std::chrono::milliseconds default_timeout;
+
+    enum defer_t { defer };
+
+    // first display name without X server lock file or socket
+    static std::string free_name(int from = 0);
 
 public:
     server() = default;
@@ -47,13 +55,35 @@ public:
 
     server(server&& x) noexcept { swap(x); }
 
-    server(const std::string& name, const std::string& server_auth, const app::arguments& args = {});
-    explicit server(const std::string& server_auth, const app::arguments& args = {}):
-        server(default_name, server_auth, args)
+    server(const std::string& name, const std::string& server_auth, const app::arguments& args = {},
+           std::chrono::milliseconds timeout = default_timeout):
+        server(defer, name, server_auth, args, timeout)
+    { wait(); }
+
+    ///
+    /// Launches X server, but does not wait for it to become ready.
+    /// Other work can be done while the server is starting up,
+    /// but wait() must be called before using the display.
+    ///
+    server(defer_t, const std::string& name, const std::string& server_auth, const app::arguments& args = {},
+           std::chrono::milliseconds timeout = default_timeout);
+
+    explicit server(const std::string& server_auth, const app::arguments& args = {},
+                    std::chrono::milliseconds timeout = default_timeout):
+        server(default_name, server_auth, args, timeout)
     { }
     ~server() { close(); }
 
     void close();
+    void wait();
+
+    ///
+    /// \brief reset
+    ///
+    /// Regenerates server cookie and resets the running X server, which
+    /// closes all client connections and re-reads the auth file.
+    ///
+    void reset();
 
     server& operator=(const server&) = delete;
     server& operator=(server&& x) noexcept
@@ -65,10 +95,16 @@ public:
     void swap(server& x) noexcept
     {
         std::swap(_M_name, x._M_name);
+        std::swap(_M_auth, x._M_auth);
         std::swap(_M_cookie, x._M_cookie);
 
         std::swap(_M_process, x._M_process);
         std::swap(_M_display, x._M_display);
+        std::swap(_M_timeout, x._M_timeout);
+        std::swap(_M_launch, x._M_launch);
+        std::swap(_M_startup, x._M_startup);
+        std::swap(_M_pending, x._M_pending);
+        std::swap(_M_child, x._M_child);
     }
 
     ////////////////////
@@ -76,16 +112,34 @@ public:
 
     bool running() { return _M_process.running(); }
 
+    // X server process (eg, to watch it with app::reactor)
+    app::process& process() noexcept { return _M_process; }
+
     x11::display display() const noexcept { return _M_display; }
 
+    // time it took the X server to become ready
+    std::chrono::milliseconds startup_time() const noexcept { return _M_startup; }
+
     void set_cookie(const std::string& path);
 
 private:
     std::string _M_name;
+    std::string _M_auth;
     x11::cookie _M_cookie;
 
     app::process _M_process;
     x11::display _M_display = nullptr;
+
+    std::chrono::milliseconds _M_timeout = default_timeout;
+    std::chrono::steady_clock::time_point _M_launch;
+    std::chrono::milliseconds _M_startup = std::chrono::milliseconds(0);
+
+    bool _M_pending = false;
+    bool _M_child = false; // SIGCHLD was already blocked
+
+    void block();
+    void unblock();
+    void wait_ready();
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
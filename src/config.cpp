@@ -7,67 +7,198 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "config.hpp"
+#include "errno_error.hpp"
+#include "storage/mapped_file.hpp"
+#include "string.hpp"
 
-#include <QFile>
+#include <QRegExp>
 
 #include <algorithm>
+#include <cctype>
+#include <utility>
 #include <stdexcept>
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static app::string_ref trimmed(app::string_ref x) noexcept
+{
+    const char* head = x.begin(), * tail = x.end();
+
+    while(head != tail && std::isspace(static_cast<unsigned char>(*head))) ++head;
+    while(tail != head && std::isspace(static_cast<unsigned char>(tail[-1]))) --tail;
+
+    return app::string_ref(head, tail - head);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static QString to_string(app::string_ref value)
+{
+    return QString::fromUtf8(value.data(), value.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool to_bool(app::string_ref value)
+{
+    if(value == "yes" || value == "true" || value == "1") return true;
+    if(value == "no" || value == "false" || value == "0") return false;
+
+    throw std::runtime_error("Invalid boolean value " + value.str());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static app::arguments to_args(app::string_ref value)
+{
+    return app::arguments::split(value.str());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static app::log::level to_level(app::string_ref value)
+{
+    static const std::pair<const char*, app::log::level> levels[] =
+    {
+        { "emergency", app::log::emergency },
+        { "alert",     app::log::alert     },
+        { "critical",  app::log::critical  },
+        { "error",     app::log::error     },
+        { "warning",   app::log::warning   },
+        { "notice",    app::log::notice    },
+        { "info",      app::log::info      },
+        { "debug",     app::log::debug     },
+    };
+    for(const auto& x : levels) if(value == x.first) return x.second;
+
+    throw std::runtime_error("Invalid log_level value " + value.str());
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Config::parse()
 {
-    QFile file(path);
-    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) throw std::runtime_error("Could not open config file");
+    // parsed in place, only the values are copied out
+    storage::mapped_file file;
+    try
+    {
+        file = storage::mapped_file(path.toStdString(), storage::advice::sequential);
+    }
+    catch(errno_error&)
+    {
+        throw std::runtime_error("Could not open config file");
+    }
 
-    while(!file.atEnd())
+    app::string_ref text = file.view();
+    for(app::string_ref::size_type from = 0; from < text.size(); )
     {
-        QString line = file.readLine().trimmed();
-        if(line.isEmpty() || line[0] == '#') continue;
+        app::string_ref::size_type pos = text.find('\n', from);
+        if(pos == app::string_ref::npos) pos = text.size();
 
-        int pos = line.indexOf('=');
-        if(pos < 0) throw std::runtime_error("Syntax error in config file");
+        app::string_ref line = trimmed(text.substr(from, pos - from));
+        from = pos + 1;
 
-        QString name = line.left(pos).trimmed();
-        QString value = line.mid(pos + 1).trimmed();
+        if(line.empty() || line[0] == '#') continue;
 
-        if(name.isEmpty()) throw std::runtime_error("Name cannot be empty");
-        if(value.isEmpty()) throw std::runtime_error("Value cannot be empty");
+        // seat section, which inherits the X server settings specified above it
+        if(line[0] == '[')
+        {
+            if(line[line.size() - 1] != ']') throw std::runtime_error("Syntax error in config file");
 
-        if(name == "xorg_name")
-            xorg_name= value.toStdString();
+            Seat seat;
+            seat.name = trimmed(line.substr(1, line.size() - 2)).str();
+            if(seat.name.empty()) throw std::runtime_error("Seat name cannot be empty");
 
-        else if(name == "xorg_args")
+            seat.xorg_vt = xorg_vt;
+            seat.xorg_args = xorg_args;
+            seat.xorg_auth = xorg_auth + "." + seat.name;
+
+            seats.push_back(seat);
+            continue;
+        }
+
+        pos = line.find('=');
+        if(pos == app::string_ref::npos) throw std::runtime_error("Syntax error in config file");
+
+        app::string_ref name = trimmed(line.substr(0, pos));
+        app::string_ref value = trimmed(line.substr(pos + 1));
+
+        if(name.empty()) throw std::runtime_error("Name cannot be empty");
+        if(value.empty()) throw std::runtime_error("Value cannot be empty");
+
+        if(seats.size())
         {
-            QStringList args = value.split(' ', QString::SkipEmptyParts);
+            Seat& seat = seats.back();
+
+            if(name == "xorg_name")
+                seat.xorg_name = value.str();
+
+            else if(name == "xorg_vt")
+                seat.xorg_vt = value.str();
+
+            else if(name == "xorg_args")
+                seat.xorg_args = to_args(value);
 
-            xorg_args.clear();
-            std::transform(args.begin(), args.end(), xorg_args.end(), [](const QString& x) { return x.toStdString(); });
+            else if(name == "xorg_auth")
+                seat.xorg_auth = value.str();
+
+            else throw std::runtime_error("Option " + name.str() + " is not allowed in seat section");
         }
+        else if(name == "xorg_name")
+            xorg_name= value.str();
+
+        else if(name == "xorg_vt")
+            xorg_vt = value.str();
+
+        else if(name == "xorg_args")
+            xorg_args = to_args(value);
+
         else if(name == "xorg_auth")
-            xorg_auth = value.toStdString();
+            xorg_auth = value.str();
+
+        else if(name == "xorg_timeout")
+        {
+            bool ok;
+            int x = to_string(value).toInt(&ok);
+            if(!ok || x <= 0) throw std::runtime_error("Invalid xorg_timeout value");
+
+            xorg_timeout = std::chrono::seconds(x);
+        }
 
         else if(name == "pam_service")
-            pam_service = value.toStdString();
+            pam_service = value.str();
 
         else if(name == "sessions_path")
-            sessions_path = value;
+            sessions_path = to_string(value);
 
         else if(name == "sessions")
-            sessions = value.split(QRegExp(" *, *"), QString::SkipEmptyParts);
+            sessions = to_string(value).split(QRegExp(" *, *"), QString::SkipEmptyParts);
+
+        else if(name == "persistent")
+            persistent = to_bool(value);
 
         else if(name == "reboot")
-            reboot = value.toStdString();
+            reboot = to_args(value);
 
         else if(name == "poweroff")
-            poweroff = value.toStdString();
+            poweroff = to_args(value);
 
         else if(name == "theme_path")
-            theme_path = value;
+            theme_path = to_string(value);
 
         else if(name == "theme_name")
-            theme_name = value;
+            theme_name = to_string(value);
 
         else if(name == "theme_file")
-            theme_file = value;
+            theme_file = to_string(value);
+
+        else if(name == "log_level")
+            log_level = to_level(value);
     }
 }
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Config::select(const std::string& name)
+{
+    auto ri = std::find_if(seats.begin(), seats.end(), [&](const Seat& x) { return x.name == name; });
+    if(ri == seats.end()) throw std::runtime_error("Seat " + name + " not found");
+
+    xorg_name = ri->xorg_name;
+    xorg_vt = ri->xorg_vt;
+    xorg_args = ri->xorg_args;
+    xorg_auth = ri->xorg_auth;
+}
@@ -10,12 +10,27 @@
 #define CONFIG_HPP
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "logger/logger.hpp"
 #include "process/arguments.hpp"
 
 #include <QString>
 #include <QStringList>
 
+#include <chrono>
 #include <string>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct Seat
+{
+    std::string name;
+
+    // X server settings
+    std::string xorg_name;
+    std::string xorg_vt;
+    app::arguments xorg_args;
+    std::string xorg_auth;
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 struct Config
@@ -24,8 +39,10 @@ struct Config
 
     // X server settings
     std::string xorg_name;
+    std::string xorg_vt;
     app::arguments xorg_args = { "-br", "-novtswitch", "-nolisten", "tcp", "-quiet" };
     std::string xorg_auth = "/run/camel.auth";
+    std::chrono::seconds xorg_timeout = std::chrono::seconds(10);
 
     // PAM settings
     std::string pam_service = "camel";
@@ -34,15 +51,26 @@ struct Config
     QString sessions_path = "/etc/X11/Sessions";
     QStringList sessions;
 
-    std::string reboot = "/sbin/reboot";
-    std::string poweroff = "/sbin/poweroff";
+    // loop back to the greeter after logout
+    bool persistent = false;
+
+    // executed directly (not through shell)
+    app::arguments reboot = { "/sbin/reboot" };
+    app::arguments poweroff = { "/sbin/poweroff" };
 
     // theme settings
     QString theme_path = "/usr/share/camel/theme";
     QString theme_name = "default";
     QString theme_file = "theme.qml";
 
+    // least severe level to log
+    app::log::level log_level = app::log::info;
+
+    // seats sharing this process
+    std::vector<Seat> seats;
+
     void parse();
+    void select(const std::string& seat);
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -6,15 +6,109 @@
 // Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#include "config.hpp"
+#include "logger/logger.hpp"
 #include "manager.hpp"
+#include "process/process.hpp"
+#include "x11/server.hpp"
 
+#include <chrono>
 #include <iostream>
+#include <set>
 #include <string>
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const std::string usage = "Usage: camel [-h|--help]\n"
                           "       camel [:n] [<path-to-config-file>]";
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int run_seat(const QString& name, const QString& path, const QString& seat)
+{
+    // blocked by the supervisor
+    app::this_process::unblock({ app::signal::terminate, app::signal::interrupt, app::signal::hangup, app::signal::child });
+
+    int code = Manager(name, path, seat).run();
+    app::process::wait_stopped();
+
+    return code;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///
+/// Runs each seat in its own child process group, so that one seat can
+/// never stall another one, and restarts it when it exits. Seats without
+/// display name are assigned the first free one not configured for any
+/// other seat.
+///
+/// On SIGTERM, SIGINT or SIGHUP all seats are stopped before exiting
+/// (their X servers are tied to them and are terminated as well).
+///
+static int supervise(const QString& path, const Config& config)
+{
+    using namespace std::chrono;
+    const seconds restart_delay(3);
+
+    // both termination requests and seat exits are accepted below
+    app::this_process::block({ app::signal::terminate, app::signal::interrupt, app::signal::hangup, app::signal::child });
+
+    size_t count = config.seats.size();
+    std::vector<app::process> children(count);
+    std::vector<std::string> names(count);
+    std::vector<steady_clock::time_point> started(count, steady_clock::now() - restart_delay);
+
+    auto is_auto = [](const std::string& name) { return name.empty() || name == "auto"; };
+
+    // explicit display names are reserved up front, so that an auto
+    // seat never takes the display of a seat started after it
+    std::set<std::string> reserved;
+    for(const Seat& seat : config.seats) if(!is_auto(seat.xorg_name)) reserved.insert(seat.xorg_name);
+
+    while(true)
+    {
+        for(size_t ri = 0; ri < count; ++ri)
+        {
+            if(children[ri].running() || steady_clock::now() - started[ri] < restart_delay) continue;
+
+            const Seat& seat = config.seats[ri];
+            std::string name = seat.xorg_name;
+            if(is_auto(name))
+            {
+                std::set<std::string> used = reserved;
+                for(size_t n = 0; n < count; ++n) if(n != ri && children[n].running()) used.insert(names[n]);
+
+                for(int from = 0;; from = std::stoi(name.substr(1)) + 1)
+                {
+                    name = x11::server::free_name(from);
+                    if(!used.count(name)) break;
+                }
+            }
+
+            try
+            {
+                children[ri] = app::process(app::process::group, run_seat, QString::fromStdString(name), path, QString::fromStdString(seat.name));
+                names[ri] = name;
+            }
+            catch(std::exception& e)
+            {
+                LOGGER(app::log::error) << "Seat " << seat.name << ": " << e.what() << std::endl;
+            }
+            started[ri] = steady_clock::now();
+        }
+
+        app::signal x = app::this_process::wait_for({ app::signal::terminate, app::signal::interrupt, app::signal::hangup, app::signal::child }, restart_delay);
+        if(x != app::signal::none && x != app::signal::child)
+        {
+            LOGGER(app::log::info) << "Stopping seats" << std::endl;
+
+            for(app::process& child : children) if(child.running()) child.stop(seconds(3));
+            app::process::wait_stopped();
+
+            return 0;
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char* argv[])
 {
@@ -40,5 +134,28 @@ int main(int argc, char* argv[])
         else path = arg;
     }
 
-    return Manager(name, path).run();
+    // keeps structured fields, if journald is running
+    app::log::open_journal();
+
+    Config config;
+    if(path.size()) config.path = path;
+    try
+    {
+        config.parse();
+    }
+    catch(std::exception& e)
+    {
+        LOGGER(app::log::error) << e.what() << std::endl;
+        return 1;
+    }
+    app::log::set_threshold(config.log_level);
+
+    if(config.seats.size()) return supervise(path, config);
+
+    // X server and other children are torn down concurrently
+    // in the background, wait for them before exiting
+    int code = Manager(name, path).run();
+    app::process::wait_stopped();
+
+    return code;
 }
@@ -7,16 +7,19 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "credentials/credentials.hpp"
+#include "credentials/credentials_cache.hpp"
 #include "errno_error.hpp"
 #include "logger/logger.hpp"
 #include "manager.hpp"
 #include "pam/pam_error.hpp"
 #include "process/environ.hpp"
+#include "process/reactor.hpp"
+#include "storage/file.hpp"
 
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QDir>
-#include <QFile>
+#include <QFileInfo>
 #include <QGraphicsObject>
 #include <QString>
 #include <QStringList>
@@ -25,44 +28,58 @@
 #include <QtDeclarative/QDeclarativeView>
 #include <QtNetwork/QHostInfo>
 
+#include <chrono>
 #include <functional>
+#include <future>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-Manager::Manager(const QString& name, const QString& path, QObject* parent):
+Manager::Manager(const QString& name, const QString& path, const QString& seat, QObject* parent):
     QObject(parent)
 {
-    ////////////////////
-    if(name.size()) config.xorg_name = name.toStdString();
-    if(config.xorg_name.empty()) config.xorg_name = x11::server::default_name;
-
     if(path.size()) config.path = path;
 
     try
     {
         config.parse();
+        log::set_threshold(config.log_level);
 
-        ////////////////////
-        settings.setHostname(QHostInfo::localHostName());
-
-        QDir dir(config.sessions_path);
-        if(dir.isReadable())
+        if(seat.size())
         {
-            QStringList sessions = dir.entryList(QDir::Files);
-            if(config.sessions.size())
-                sessions = sessions.toSet().intersect(config.sessions.toSet()).toList();
-
-            settings.setSessions(sessions);
+            config.select(seat.toStdString());
+            log::set_context("SEAT", seat.toStdString());
         }
 
+        if(name.size()) config.xorg_name = name.toStdString();
+        if(config.xorg_name.empty())
+            config.xorg_name = x11::server::default_name;
+        else if(config.xorg_name == "auto")
+            config.xorg_name = x11::server::free_name();
+        log::set_context("DISPLAY", config.xorg_name);
+
+        app::arguments args = config.xorg_args;
+        if(config.xorg_vt.size()) args.insert("vt" + config.xorg_vt);
+
         ////////////////////
-        server = x11::server(config.xorg_name, config.xorg_auth, config.xorg_args);
+        // X server is launched first and the rest
+        // of the startup overlaps with its initialization
+        server = x11::server(x11::server::defer, config.xorg_name, config.xorg_auth, args, config.xorg_timeout);
+
+        auto hostname = std::async(std::launch::async, &QHostInfo::localHostName);
+        auto sessions = std::async(std::launch::async, &Manager::scan_sessions, this);
+        auto theme = std::async(std::launch::async, &Manager::load_theme, this);
+
+        open_context();
 
-        context = pam::context(config.pam_service);
-        context.set_pass_func(std::bind(&Manager::password, this, std::placeholders::_1, std::placeholders::_2));
-        context.set_error_func(std::bind(&Manager::response, this, std::placeholders::_1));
+        server.wait();
+        LOGGER(log::info)
+               << log::field("STAGE", "xserver")
+               << log::field("DURATION_US", std::chrono::duration_cast<std::chrono::microseconds>(server.startup_time()).count())
+               << "X server started in " << server.startup_time().count() << " ms" << std::endl;
 
-        context.insert(pam::item::ruser, "root");
-        context.insert(pam::item::tty, server.name());
+        ////////////////////
+        settings.setHostname(hostname.get());
+        settings.setSessions(sessions.get());
+        theme.get();
     }
     catch(...)
     {
@@ -70,6 +87,55 @@ Manager::Manager(const QString& name, const QString& path, QObject* parent):
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+QStringList Manager::scan_sessions()
+{
+    QStringList sessions;
+
+    QDir dir(config.sessions_path);
+    if(dir.isReadable())
+    {
+        sessions = dir.entryList(QDir::Files);
+        if(config.sessions.size())
+            sessions = sessions.toSet().intersect(config.sessions.toSet()).toList();
+    }
+    return sessions;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Manager::load_theme()
+{
+    QDir dir(config.theme_path + "/" + config.theme_name);
+    if(!dir.exists())
+        throw std::runtime_error("Theme dir " + config.theme_name.toStdString() + " not found");
+
+    if(!dir.exists(config.theme_file))
+        throw std::runtime_error("Theme file " + config.theme_file.toStdString() + " not found");
+
+    // start pulling theme assets into the page cache, so that QML engine
+    // does not have to wait for the disk; the kernel reads them ahead
+    // in the background, nothing is read (or copied) here
+    foreach(const QFileInfo& info, dir.entryInfoList(QDir::Files))
+    {
+        try
+        {
+            storage::file(info.filePath().toStdString(), storage::open::read).prefetch();
+        }
+        catch(errno_error&) { }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Manager::open_context()
+{
+    context = pam::context(config.pam_service);
+    context.set_pass_func(std::bind(&Manager::password, this, std::placeholders::_1, std::placeholders::_2));
+    context.set_error_func(std::bind(&Manager::response, this, std::placeholders::_1));
+
+    context.insert(pam::item::ruser, "root");
+    context.insert(pam::item::tty, server.name());
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Manager::enter()
 {
@@ -86,35 +152,79 @@ try
 {
     if(exception) std::rethrow_exception(exception);
 
+    do
     {
-        QApplication app(server.display());
-        render();
-        app.flush();
+        {
+            QApplication app(server.display());
+            render();
+            app.flush();
 
-        while(true)
+            while(true)
+            {
+                emit enter_user_pass();
+                if(QApplication::exec() == code_enter && authenticate()) break;
+            }
+        }
+
+        context.open_session();
+
+        QString session = settings.session();
+        if(!session.size()) session = "Xsession";
+
+        std::string user = context.get(pam::item::user);
+        log::set_context("USER", user);
+
+        // looked up once per login (and usually
+        // already cached by change_password)
+        credentials c = credentials_cache::instance().get(user);
+
+        LOGGER(log::info) << log::field("STAGE", "session") << "Session " << session.toStdString() << " opened for " << user << std::endl;
+        auto opened = std::chrono::steady_clock::now();
+
+        app::process process(process::group, &Manager::startup, this, session, c);
+
+        // X server may die while the session is running
+        bool server_died = false;
         {
-            emit enter_user_pass();
-            if(QApplication::exec() == code_enter && authenticate()) break;
+            app::reactor watcher;
+            watcher.watch(process, nullptr);
+            watcher.watch(server.process(), [&](const app::exit_code&){ server_died = true; });
+            watcher.wait();
         }
-    }
 
-    context.open_session();
+        if(server_died) process.stop(std::chrono::seconds(3));
+        context.close_session();
 
-    QString session = settings.session();
-    if(!session.size()) session = "Xsession";
+        LOGGER(log::info)
+               << log::field("STAGE", "session")
+               << log::field("DURATION_US", std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - opened).count())
+               << "Session closed for " << user << std::endl;
+        log::set_context("USER", std::string());
 
-    app::process process(process::group, &Manager::startup, this, session);
-    process.join();
+        if(server_died) throw std::runtime_error("X server died");
+
+        if(config.persistent) reset();
+    }
+    while(config.persistent);
 
-    context.close_session();
     return 0;
 }
 catch(std::exception& e)
 {
-    logger << log::error << e.what() << std::endl;
+    LOGGER(log::error) << e.what() << std::endl;
     return 1;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Manager::reset()
+{
+    settings.setPassword(QString());
+    settings.setPassword_n(QString());
+
+    server.reset();
+    open_context();
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Manager::render()
 {
@@ -124,9 +234,6 @@ void Manager::render()
         if(!QDir::setCurrent(config.theme_path + "/" + config.theme_name))
             throw std::runtime_error("Theme dir " + config.theme_name.toStdString() + " not found");
 
-        if(!QFile::exists(config.theme_file))
-            throw std::runtime_error("Theme file " + config.theme_file.toStdString() + " not found");
-
         QDeclarativeView* view = new QDeclarativeView(QApplication::desktop());
         view->rootContext()->setContextProperty("settings", &settings);
         view->setSource(QUrl::fromLocalFile(config.theme_file));
@@ -229,36 +336,43 @@ catch(pam::pamh_error& e)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int Manager::startup(const QString& session)
+int Manager::startup(const QString& session, const credentials& c)
 {
-    credentials c(context.get(pam::item::user));
-    app::environ e;
+    std::string auth = c.home() + "/.Xauthority";
 
-    std::string auth = c.home()+ "/.Xauthority";
-
-    std::string x;
-    bool found;
+    ////////////////////
+    // variables set here take precedence over those set by PAM
+    // modules, which in turn take precedence over the inherited ones
+    app::environ e;
+    e.reserve(7);
 
     e.insert("USER", c.username());
     e.insert("LOGNAME", c.username());
     e.insert("HOME", c.home());
-
-    x = this_environ::get("PATH", &found);
-    if(found) e.insert("PATH", x);
-
     e.insert("PWD", c.home());
     e.insert("SHELL", c.shell());
-
-    x = this_environ::get("TERM", &found);
-    if(found) e.insert("TERM", x);
-
     e.insert("DISPLAY", context.get(pam::item::tty));
     e.insert("XAUTHORITY", auth);
 
+    // insert does not replace variables set by PAM
+    app::environ base = context.environ();
+
+    this_environ::snapshot parent;
+    for(const char* name: { "PATH", "TERM" })
+    {
+        bool found;
+        string_ref value = parent.get_ref(name, &found);
+        if(found) base.insert(name, value.str());
+    }
+
+    // both are merged straight into envp
+    charpp_ptr envp = app::environ::compose({ &e, &base });
+
+    ////////////////////
     c.morph_into();
     server.set_cookie(auth);
 
-    this_process::replace_e(e, (config.sessions_path + "/" + session).toStdString());
+    this_process::replace_e(envp.get(), (config.sessions_path + "/" + session).toStdString());
     return 1;
 }
 
@@ -266,7 +380,7 @@ int Manager::startup(const QString& session)
 bool Manager::change_password()
 {
     app::uid orig_uid = this_user::uid();
-    this_user::morph_into( credentials(context.get(pam::item::user)).uid(), false );
+    this_user::morph_into( credentials_cache::instance().get(context.get(pam::item::user)).uid(), false );
 
     bool code = true;
     try
@@ -288,30 +402,76 @@ bool Manager::change_password()
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Manager::reboot()
-try
 {
     emit info("Rebooting");
-    if(this_process::execute(config.reboot).code() == 0)
-        QApplication::exit(code_cancel);
-    else emit error("Reboot command failed");
-}
-catch(execute_error& e)
-{
-    emit error(e.what());
-    logger << e.what() << std::endl;
+    execute(config.reboot, "Reboot");
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Manager::poweroff()
-try
 {
     emit info("Powering off");
-    if(this_process::execute(config.poweroff).code() == 0)
-        QApplication::exit(code_cancel);
-    else emit error("Poweroff command failed");
+    execute(config.poweroff, "Poweroff");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Manager::execute(const app::arguments& args, const QString& name)
+{
+    bool created = false;
+    try
+    {
+        if(reactor || command.running()) throw std::runtime_error("Another command is already running");
+        if(args.empty()) throw std::runtime_error(name.toStdString() + " command is not set");
+
+        app::arguments x = args;
+        std::string path = *x.begin();
+        x.erase(x.begin());
+
+        // SIGCHLD has to be blocked before the command is spawned
+        reactor.reset(new app::reactor());
+        created = true;
+
+        command = process::spawn(path, x);
+
+        reactor->watch(command, [this, name](const app::exit_code& code)
+        {
+            if(code.is_exit() && code.code() == 0)
+            {
+                emit info(name + " command completed");
+                QApplication::exit(code_cancel);
+            }
+            else emit error(name + " command failed");
+        });
+
+        notifier.reset(new QSocketNotifier(reactor->fd(), QSocketNotifier::Read));
+        connect(notifier.get(), SIGNAL(activated(int)), this, SLOT(dispatch()));
+    }
+    catch(std::exception& e)
+    {
+        // tear down only what this call has set up;
+        // a command started earlier keeps its reactor
+        if(created)
+        {
+            notifier.reset();
+            reactor.reset();
+        }
+
+        emit error(e.what());
+        LOGGER(log::error) << e.what() << std::endl;
+    }
 }
-catch(execute_error& e)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Manager::dispatch()
 {
-    emit error(e.what());
-    logger << e.what() << std::endl;
+    if(!reactor) return;
+
+    reactor->dispatch();
+    if(reactor->empty())
+    {
+        // notifier is still delivering its signal
+        notifier->setEnabled(false);
+        notifier.release()->deleteLater();
+        reactor.reset();
+    }
 }
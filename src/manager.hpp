@@ -11,15 +11,21 @@
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #include "config.hpp"
+#include "credentials/credentials.hpp"
 #include "pam/pam.hpp"
+#include "process/process.hpp"
+#include "process/reactor.hpp"
 #include "settings.hpp"
 #include "x11/server.hpp"
 
 #include <QObject>
+#include <QSocketNotifier>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 
 #include <exception>
+#include <memory>
 
 using namespace app;
 
@@ -28,7 +34,7 @@ class Manager: public QObject
 {
     Q_OBJECT
 public:
-    explicit Manager(const QString& name, const QString& path, QObject* parent = nullptr);
+    explicit Manager(const QString& name, const QString& path, const QString& seat = QString(), QObject* parent = nullptr);
     int run();
 
     static constexpr int code_enter = 0;
@@ -47,6 +53,8 @@ private slots:
     void reboot();
     void poweroff();
 
+    void dispatch();
+
 private:
     Config config;
     Settings settings;
@@ -54,6 +62,13 @@ private:
     x11::server server;
     pam::context context;
 
+    QStringList scan_sessions();
+    void load_theme();
+
+    void open_context();
+
+    void reset();
+
     void render();
 
     bool do_respond = false;
@@ -63,7 +78,15 @@ private:
     bool authenticate();
 
     bool change_password();
-    int startup(const QString& session);
+    int startup(const QString& session, const credentials& c);
+
+    // reboot and poweroff commands run in the background,
+    // while the greeter keeps processing events
+    app::process command;
+    std::unique_ptr<app::reactor> reactor;
+    std::unique_ptr<QSocketNotifier> notifier;
+
+    void execute(const app::arguments& command, const QString& name);
 
     std::exception_ptr exception = nullptr;
 };